@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <time.h>
 #include <stdlib.h>
+#include <string.h>
 #include "display.h"
 #include "vector.h"
 #include "triangle.h"
@@ -17,6 +18,14 @@
 #include "keyboard.h"
 #include "camera.h"
 #include "mesh.h"
+#include "lod.h"
+#include "resolution.h"
+#include "batch.h"
+#include "loader.h"
+#include "atlas.h"
+#include "texture_registry.h"
+#include "texture_residency.h"
+#include "async_present.h"
 #include "app.h"
 
 #ifdef _WIN32
@@ -27,11 +36,54 @@
 
 #define MAX_TRIANGLES 10000
 triangle_t triangles_to_render[MAX_TRIANGLES];
+
 int num_triangles_to_render = 0;
+// Screen area covered by the triangles to render, used by the LOD controller
+float num_pixels_to_render = 0.0f;
+
+// Frames rendered per texture layout by --benchmark-textures
+#define TEXTURE_BENCHMARK_FRAMES 360
+
+// Everything that is the same for every mesh in a frame, computed once per frame
+typedef struct
+{
+	mat4_t view_matrix;
+	mat4_t proj_matrix;
+	int camera_version; // bumped whenever the view or projection matrix changes
+} frame_constants_t;
 
-mat4_t world_matrix;
-mat4_t view_matrix;
-mat4_t proj_matrix;
+frame_constants_t frame;
+
+// Everything a frame is drawn from that input or the scene can change. Two frames
+// drawn from the same state and the same triangles are the same picture
+typedef struct
+{
+	vec3_t camera_position;
+	float camera_yaw;
+	float camera_pitch;
+	float fovy;
+	enum Render_Method render_method;
+	bool cull;
+	bool lighting;
+	bool static_batching;
+	bool mipmapping;
+	enum Texture_Filter texture_filter;
+	bool compressed_textures;
+	uint32_t color;
+	vec3_t light_direction;
+	float lod_bias;
+	int num_meshes;
+	struct
+	{
+		vec3_t scale;
+		vec3_t rotation;
+		vec3_t translation;
+	} meshes[MAX_NUM_MESHES];
+} scene_state_t;
+
+// The state the frame on the screen was drawn from
+scene_state_t drawn_state;
+bool has_drawn_state = false;
 
 // Used with the animate_rectangles function
 int rect_count = 20;
@@ -42,17 +94,40 @@ int rect_count = 20;
 void setup(AppState *app)
 {
 	camera_init();
+	lod_controller_init();
 
 	// Load the mesh in mesh.h
 	//load_cube_mesh_data();
 
-	// load_mesh("./assets/f22.obj", "./assets/f22.png", (vec3_t){1, 1, 1}, (vec3_t){-3, 0, 5}, (vec3_t){0, 0, 0});
-	// load_mesh("./assets/cube.obj", "./assets/cube.png", (vec3_t){1, 1, 1}, (vec3_t){3, 0, 5}, (vec3_t){0, 0, 0});
+	// load_mesh("./assets/f22.obj", "./assets/f22.png", (vec3_t){1, 1, 1}, (vec3_t){-3, 0, 5}, (vec3_t){0, 0, 0}, true);
+	// load_mesh("./assets/cube.obj", "./assets/cube.png", (vec3_t){1, 1, 1}, (vec3_t){3, 0, 5}, (vec3_t){0, 0, 0}, false);
+
+	// Parse the OBJs and decode the PNGs of the whole scene in parallel
+	mesh_job_t scene[] = {
+		{"./assets/runway.obj", "./assets/runway.png", (vec3_t){1, 1, 2}, (vec3_t){0, -1.5, +43}, (vec3_t){0, 0, 0}, false},
+		{"./assets/f22.obj", "./assets/f22.png", (vec3_t){1, 1, 1}, (vec3_t){0, -1.3, +5}, (vec3_t){0, -M_PI/2, 0}, true},
+		{"./assets/efa.obj", "./assets/efa.png", (vec3_t){1, 1, 1}, (vec3_t){-2, -1.3, +9}, (vec3_t){0, -M_PI/2, 0}, true},
+		{"./assets/f117.obj", "./assets/f117.png", (vec3_t){1, 1, 1}, (vec3_t){+2, -1.3, +9}, (vec3_t){0, -M_PI/2, 0}, true},
+		// Placed relative to the F22 it escorts, see below
+		{"./assets/drone.obj", "./assets/drone.png", (vec3_t){0.3, 0.3, 0.3}, (vec3_t){0.5, 0.8, -1.6}, (vec3_t){0, 0, 0}, true}
+	};
+	load_meshes(scene, sizeof(scene) / sizeof(scene[0]));
+
+	// The drone flies in the F22's frame, so it keeps its place off the jet wherever the jet goes
+	mesh_set_parent(4, 1);
+
+	// The runway is stretched to twice its length, tile its texture along it instead of stretching that too
+	mesh_set_texture_repeat(get_mesh(0), 1, 2);
 
-	load_mesh("./assets/runway.obj", "./assets/runway.png", (vec3_t){1, 1, 1}, (vec3_t){0, -1.5, +23}, (vec3_t){0, 0, 0});
-    load_mesh("./assets/f22.obj", "./assets/f22.png", (vec3_t){1, 1, 1}, (vec3_t){0, -1.3, +5}, (vec3_t){0, -M_PI/2, 0});
-    load_mesh("./assets/efa.obj", "./assets/efa.png", (vec3_t){1, 1, 1}, (vec3_t){-2, -1.3, +9}, (vec3_t){0, -M_PI/2, 0});
-    load_mesh("./assets/f117.obj", "./assets/f117.png", (vec3_t){1, 1, 1}, (vec3_t){+2, -1.3, +9}, (vec3_t){0, -M_PI/2, 0});
+	// Share texture pages between meshes, so static batching can merge them across textures
+	build_texture_atlases();
+
+	// Nothing in this scene moves, so every mesh can be merged into a static batch
+	for (int i = 0; i < get_num_meshes(); i++)
+	{
+		get_mesh(i)->is_static = true;
+	}
+	build_static_batches();
 
 	current_color = colors[color_index];
 }
@@ -82,45 +157,20 @@ void setup(AppState *app)
 //                        `--> | Screen space |  <-- ready to render
 //                             +--------------+
 ///////////////////////////////////////////////////////////////////////////////
-void process_graphics_pipeline_stages(AppState *app, mesh_t *mesh)
+void process_faces(AppState *app, vec3_t *vertices, face_t *faces, texture_t *texture, enum Texture_Wrap texture_wrap, mat4_t world_view_matrix)
 {
-	// Initialize frustum planes with a point and a normal
-	init_frustum_planes(app->fovx, app->fovy, app->znear, app->zfar);
-
-	camera_update_direction();
-	view_matrix = mat4_look_at(camera.position, camera.target, camera.up);
-
-	proj_matrix = mat4_make_perspective(app->fovy, app->aspectx, app->znear, app->zfar);
-
-	// Create a scale, translation, and rotation matrix that will be used to transform our mesh vertices
-	mat4_t scale_matrix = mat4_make_scale(mesh->scale.x, mesh->scale.y, mesh->scale.z);
-	mat4_t rotation_matrix_x = mat4_make_rotation_x(mesh->rotation.x);
-	mat4_t rotation_matrix_y = mat4_make_rotation_y(mesh->rotation.y);
-	mat4_t rotation_matrix_z = mat4_make_rotation_z(mesh->rotation.z);
-	mat4_t translation_matrix = mat4_make_translation(mesh->translation.x, mesh->translation.y, mesh->translation.z);
-
-	// Create a World Matrix that combines our scale, rotation, and translation matrices
-	world_matrix = mat4_identity();
-
-	// Order matters: First scale, then rotate, then translate (AxB != BxA)
-	world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
-	world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
-	world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
-	world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
-	world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
-
-	int num_faces = array_length(mesh->faces);
+	int num_faces = array_length(faces);
 	// Loop all triangle faces of our mesh
 	for (int i = 0; i < num_faces; i++)
 	{
-		face_t mesh_face = mesh->faces[i];
+		face_t mesh_face = faces[i];
 		mesh_face.color = current_color;
 		vec3_t face_vertices[3];
 
 		// Get the 3 vertices for each face
-		face_vertices[0] = mesh->vertices[mesh_face.a - 1];
-		face_vertices[1] = mesh->vertices[mesh_face.b - 1];
-		face_vertices[2] = mesh->vertices[mesh_face.c - 1];
+		face_vertices[0] = vertices[mesh_face.a - 1];
+		face_vertices[1] = vertices[mesh_face.b - 1];
+		face_vertices[2] = vertices[mesh_face.c - 1];
 
 		vec4_t transformed_vertices[3];
 
@@ -129,10 +179,8 @@ void process_graphics_pipeline_stages(AppState *app, mesh_t *mesh)
 		{
 			vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
 
-			// Multiply the World Matrix by the original vector
-			transformed_vertex = mat4_mul_vec4(world_matrix, transformed_vertex);
-			// Multiply the View Matrix by the new World Space vector
-			transformed_vertex = mat4_mul_vec4(view_matrix, transformed_vertex);
+			// Multiply the World-View Matrix by the original vector to get to camera space
+			transformed_vertex = mat4_mul_vec4(world_view_matrix, transformed_vertex);
 
 			transformed_vertices[j] = transformed_vertex;
 		}
@@ -182,7 +230,7 @@ void process_graphics_pipeline_stages(AppState *app, mesh_t *mesh)
 			for (int j = 0; j < 3; j++)
 			{
 				// Project the vertex
-				projected_points[j] = mat4_mul_vec4_project(proj_matrix, triangle_after_clipping.points[j]);
+				projected_points[j] = mat4_mul_vec4_project(frame.proj_matrix, triangle_after_clipping.points[j]);
 
 				// Invert the y-axis to account for y growing top-down
 				projected_points[j].y *= -1;
@@ -226,13 +274,19 @@ void process_graphics_pipeline_stages(AppState *app, mesh_t *mesh)
 					{triangle_after_clipping.texcoords[2].u, triangle_after_clipping.texcoords[2].v},
 				},
 				.color = triangle_color,
-				.texture = mesh->texture
+				.texture = texture,
+				.texture_wrap = texture_wrap
 			};
 
 			// Save the projected triangle in the array of triangles to render
 			if (num_triangles_to_render < MAX_TRIANGLES)
 			{
 				triangles_to_render[num_triangles_to_render++] = triangle_to_render;
+
+				// Half the 2D cross product of two edges is the triangle's area in pixels
+				vec2_t ab = vec2_sub(vec2_from_vec4(projected_points[1]), vec2_from_vec4(projected_points[0]));
+				vec2_t ac = vec2_sub(vec2_from_vec4(projected_points[2]), vec2_from_vec4(projected_points[0]));
+				num_pixels_to_render += fabsf(ab.x * ac.y - ab.y * ac.x) * 0.5f;
 			}
 
 			// Add the projected triangle to the array of traingles to render
@@ -241,6 +295,67 @@ void process_graphics_pipeline_stages(AppState *app, mesh_t *mesh)
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Compute the frame constants once per frame, before any mesh is processed.
+// The matrices are only replaced (and the meshes' cached matrices only go
+// stale) when the camera or the projection actually changed.
+///////////////////////////////////////////////////////////////////////////////
+void process_frame_constants(AppState *app)
+{
+	camera_update_direction();
+	mat4_t view_matrix = mat4_look_at(camera.position, camera.target, camera.up);
+	mat4_t proj_matrix = mat4_make_perspective(app->fovy, app->aspectx, app->znear, app->zfar);
+
+	bool view_changed = memcmp(&view_matrix, &frame.view_matrix, sizeof(mat4_t)) != 0;
+	bool proj_changed = memcmp(&proj_matrix, &frame.proj_matrix, sizeof(mat4_t)) != 0;
+
+	if (proj_changed)
+	{
+		// Initialize frustum planes with a point and a normal
+		init_frustum_planes(app->fovx, app->fovy, app->znear, app->zfar);
+		frame.proj_matrix = proj_matrix;
+	}
+	if (view_changed)
+	{
+		frame.view_matrix = view_matrix;
+	}
+	if (view_changed || proj_changed)
+	{
+		frame.camera_version++;
+	}
+}
+
+void process_graphics_pipeline_stages(AppState *app, mesh_t *mesh)
+{
+	// Rebuild the cached World, World-View and MVP matrices if the mesh or the camera moved
+	mesh_update_matrices(mesh, frame.view_matrix, frame.proj_matrix, frame.camera_version);
+
+	// Nothing of the mesh can survive clipping, and its texture isn't needed this frame
+	if (!mesh_in_frustum(mesh))
+		return;
+	texture_residency_touch(mesh->texture);
+
+	// Pick a level of detail from how many pixels the mesh covers on the screen
+	float projected_size = lod_projected_size(mesh, app->fovy, app->win.height);
+	mesh->lod_level = lod_select_level(mesh, projected_size, lod_controller.bias);
+	mesh_lod_t *lod = &mesh->lods[mesh->lod_level];
+
+	process_faces(app, lod->vertices, lod->faces, mesh->texture, mesh->texture_wrap, mesh->world_view_matrix);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Static batches are already in world space, so they skip the world matrix
+///////////////////////////////////////////////////////////////////////////////
+void process_batch_pipeline_stages(AppState *app, batch_t *batch)
+{
+	int first_triangle = num_triangles_to_render;
+	process_faces(app, batch->vertices, batch->faces, batch->texture, batch->texture_wrap, frame.view_matrix);
+
+	// A batch has no bounds of its own, it's visible if any of its triangles survived clipping
+	if (num_triangles_to_render > first_triangle)
+		texture_residency_touch(batch->texture);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Update function frame by frame with a fixed time step
 ///////////////////////////////////////////////////////////////////////////////
@@ -253,43 +368,83 @@ void update(AppState *app)
 	// 	triangles_to_render = NULL;
 	// }
 
-	// Make sure the desired FPS is reached
-	int time_to_wait = app->frame_target_time - (SDL_GetTicks() - app->previous_frame_time);
+	if (app->win.headless)
+	{
+		// Nobody is watching, so don't wait. Every frame steps the same amount, so runs are repeatable
+		app->delta_time = app->frame_target_time / 1000.0f;
+	}
+	else
+	{
+		// Make sure the desired FPS is reached
+		int time_to_wait = app->frame_target_time - (SDL_GetTicks() - app->previous_frame_time);
 
-	if (time_to_wait > 0 && time_to_wait < app->frame_target_time)
-		SDL_Delay(time_to_wait);
+		if (time_to_wait > 0 && time_to_wait < app->frame_target_time)
+			SDL_Delay(time_to_wait);
 
-	// Delta time is the time since the previous frame in seconds, and its used for consistent animations, regardless of FPS
-	app->delta_time = (SDL_GetTicks() - app->previous_frame_time) / 1000.0f;
+		// Delta time is the time since the previous frame in seconds, and its used for consistent animations, regardless of FPS
+		app->delta_time = (SDL_GetTicks() - app->previous_frame_time) / 1000.0f;
+	}
 
 	app->previous_frame_time = SDL_GetTicks();
 
+	// Let the LOD controller react to how much work the last frame was
+	lod_controller_update(app->work_time, app->frame_target_time, num_triangles_to_render, num_pixels_to_render,
+	                      app->win.width * app->win.height);
+
+	// And the resolution controller to how long it took to rasterize, this frame is drawn at the size it picks
+	resolution_controller_update(app->raster_time, app->frame_target_time);
+	resolution_controller_apply(&app->win);
+
+	app->work_start = SDL_GetPerformanceCounter();
+
+	// Take in the texture levels loaded since last frame and ask for what last frame was missing
+	texture_residency_update();
+
 	num_triangles_to_render = 0;
+	num_pixels_to_render = 0.0f;
+
+	process_frame_constants(app);
+
+	// Bring every World Matrix up to date, parents before children
+	update_mesh_transforms();
 
 	for (int mesh_index = 0; mesh_index < get_num_meshes(); mesh_index++)
 	{
 		mesh_t *mesh = get_mesh(mesh_index);
 		//mesh_t *mesh = &m;
 
+		// Static meshes are drawn through their batch instead
+		if (app->static_batching && mesh->is_static)
+			continue;
+
 		// Translate the mesh away from the camera
 		//mesh->translation.z = 5.0f;
 
 		process_graphics_pipeline_stages(app, mesh);
 		
 	}
+
+	if (app->static_batching)
+	{
+		for (int batch_index = 0; batch_index < get_num_batches(); batch_index++)
+		{
+			process_batch_pipeline_stages(app, get_batch(batch_index));
+		}
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Render function to draw objects on the display
+// Draw the triangles update() found into the window's color buffer. Only
+// the window's buffers are written, so with the async present this runs on
+// the raster thread while the main thread presents the previous frame.
 ///////////////////////////////////////////////////////////////////////////////
-void render(AppState *app)
+void rasterize(AppState *app)
 {
-	// Background color
-	clear_color_buffer(&app->win, BLACK); 
-	// Set every pixels depth to 1.0
-	clear_z_buffer(&app->win);
+	uint64_t raster_start = SDL_GetPerformanceCounter();
 
-	draw_dotted_grid(&app->win, 0, 0, app->win.width - 1, app->win.height - 1, 30, DARK_GRAY);
+	// Background color and dotted grid, and every pixel's depth to 1.0, as each tile is first drawn into.
+	// The grid is prerendered once, and only rendered again if the render size changes
+	window_clear_background(&app->win, BLACK, 30, DARK_GRAY);
 
 	//int num_triangles = array_length(triangles_to_render);
 	int num_triangles = num_triangles_to_render;
@@ -313,8 +468,27 @@ void render(AppState *app)
 
 		if (should_render_textured_triangles(app))
 		{
+			// Pick the mip level from how much texture this triangle squeezes into each pixel
+			int mip_level = app->mipmapping ? texture_select_mip(t.texture, t.points, t.texcoords) : 0;
+			texture_residency_want(t.texture, mip_level);
+
+			// Flat shade until the texture's first levels are loaded
+			if (!texture_is_resident(t.texture))
+			{
+				draw_filled_triangle(
+					&app->win,
+					t.points[0].x, t.points[0].y, t.points[0].z, t.points[0].w,
+					t.points[1].x, t.points[1].y, t.points[1].z, t.points[1].w,
+					t.points[2].x, t.points[2].y, t.points[2].z, t.points[2].w,
+					t.color
+				);
+				continue;
+			}
+
+			sampler_t sampler = texture_get_sampler(t.texture, mip_level, t.texture_wrap, app->texture_filter);
+
 			draw_textured_triangle(
-				&app->win, t.texture,
+				&app->win, &sampler,
 				t.points[0].x, t.points[0].y, t.points[0].z, t.points[0].w, t.texcoords[0].u, t.texcoords[0].v,
 				t.points[1].x, t.points[1].y, t.points[1].z, t.points[1].w, t.texcoords[1].u, t.texcoords[1].v,
 				t.points[2].x, t.points[2].y, t.points[2].z, t.points[2].w, t.texcoords[2].u, t.texcoords[2].v
@@ -351,11 +525,165 @@ void render(AppState *app)
 
 	//animate_rectangles(&app->win, rect_count, app->paused ? 0.0f : app->delta_time);
 
-	// Copy the pixel data over to the SDL texture
-	render_color_buffer(&app->win);
+	// Whatever nothing drew over still needs its background
+	window_fill_untouched_tiles(&app->win);
+
+	app->raster_time = (SDL_GetPerformanceCounter() - raster_start) * 1000.0f / SDL_GetPerformanceFrequency();
+}
+
+static void rasterize_frame(void *data)
+{
+	rasterize((AppState*)data);
+}
+
+// Time spent since update started, the frame limiter's delay isn't part of it
+void measure_work_time(AppState *app)
+{
+	if (!app->paused)
+	{
+		app->work_time = (SDL_GetPerformanceCounter() - app->work_start) * 1000.0f / SDL_GetPerformanceFrequency();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Render function to draw objects on the display
+///////////////////////////////////////////////////////////////////////////////
+void render(AppState *app)
+{
+	// Get somewhere to draw the frame
+	if (!window_begin_frame(&app->win))
+		return;
+
+	rasterize(app);
+
+	// Show the frame, or write it out when headless
+	window_present(&app->win);
+
+	measure_work_time(app);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Snapshot of the state the next frame would be drawn from. It's zeroed
+// first so the padding compares equal too.
+///////////////////////////////////////////////////////////////////////////////
+void capture_scene_state(AppState *app, scene_state_t *state)
+{
+	memset(state, 0, sizeof(*state));
+
+	state->camera_position = camera.position;
+	state->camera_yaw = camera.yaw;
+	state->camera_pitch = camera.pitch;
+	state->fovy = app->fovy;
+	state->render_method = app->render_method;
+	state->cull = app->cull;
+	state->lighting = app->lighting;
+	state->static_batching = app->static_batching;
+	state->mipmapping = app->mipmapping;
+	state->texture_filter = app->texture_filter;
+	state->compressed_textures = app->compressed_textures;
+	state->color = current_color;
+	state->light_direction = light.direction;
+	state->lod_bias = lod_controller.bias;
+
+	state->num_meshes = get_num_meshes();
+	for (int i = 0; i < state->num_meshes; i++)
+	{
+		mesh_t *mesh = get_mesh(i);
+		state->meshes[i].scale = mesh->scale;
+		state->meshes[i].rotation = mesh->rotation;
+		state->meshes[i].translation = mesh->translation;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A paused frame is only drawn again if something it's drawn from changed
+// since the one on the screen. update() doesn't run while paused, so the
+// triangles are the same ones, and the same state draws the same picture.
+///////////////////////////////////////////////////////////////////////////////
+bool frame_unchanged(AppState *app)
+{
+	if (!app->paused || app->win.headless || !has_drawn_state)
+		return false;
+
+	scene_state_t state;
+	capture_scene_state(app, &state);
+	return memcmp(&state, &drawn_state, sizeof(state)) == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Render the scene with every mesh spinning about its yaw axis, with linear,
+// tiled and BC1 compressed textures, and print the average frame time of each.
+// Spinning turns the -M_PI/2 yawed jets through every angle, so the sampler
+// walks the textures along U, V and everything in between. Each layout runs
+// with and without mipmapping, since minified triangles are where row-major
+// textures miss the cache the most.
+///////////////////////////////////////////////////////////////////////////////
+void benchmark_texture_layouts(AppState *app)
+{
+	enum Texture_Layout layouts[] = {TEXTURE_LINEAR, TEXTURE_TILED, TEXTURE_BC1};
+	const char *layout_names[] = {"Linear", "4x4 tiled", "BC1 compressed"};
+	int num_layouts = sizeof(layouts) / sizeof(layouts[0]);
+
+	enum Render_Method render_method = app->render_method;
+	bool static_batching = app->static_batching;
+	float frame_target_time = app->frame_target_time;
+	bool mipmapping = app->mipmapping;
+
+	vec3_t rotations[MAX_NUM_MESHES];
+	for (int i = 0; i < get_num_meshes(); i++)
+	{
+		rotations[i] = get_mesh(i)->rotation;
+	}
+
+	// Textured, every mesh through its own pipeline, and no frame limiter
+	app->render_method = RENDER_TEXTURED;
+	app->static_batching = false;
+	app->frame_target_time = 0;
+
+	printf("\n========= TEXTURE LAYOUT BENCHMARK =========\n");
+
+	for (int run = 0; run < 2 * num_layouts; run++)
+	{
+		int l = run % num_layouts;
+		app->mipmapping = run >= num_layouts;
+
+		for (int i = 0; i < get_num_meshes(); i++)
+		{
+			if (get_mesh(i)->texture)
+				texture_set_layout(get_mesh(i)->texture, layouts[l]);
+		}
+
+		uint64_t start = SDL_GetPerformanceCounter();
+
+		for (int f = 0; f < TEXTURE_BENCHMARK_FRAMES; f++)
+		{
+			float angle = 2.0f * M_PI * f / TEXTURE_BENCHMARK_FRAMES;
+			for (int i = 0; i < get_num_meshes(); i++)
+			{
+				mesh_set_rotation(get_mesh(i), (vec3_t){rotations[i].x, rotations[i].y + angle, rotations[i].z});
+			}
+
+			update(app);
+			render(app);
+		}
+
+		float total_time = (SDL_GetPerformanceCounter() - start) * 1000.0f / SDL_GetPerformanceFrequency();
+		printf("%s, mipmapping %s: %.3fms per frame over %d frames\n",
+			layout_names[l], app->mipmapping ? "on" : "off", total_time / TEXTURE_BENCHMARK_FRAMES, TEXTURE_BENCHMARK_FRAMES);
+	}
+
+	printf("============================================\n");
 
-	// Draw the new frame
-	SDL_RenderPresent(app->win.renderer);
+	for (int i = 0; i < get_num_meshes(); i++)
+	{
+		mesh_set_rotation(get_mesh(i), rotations[i]);
+		if (get_mesh(i)->texture)
+			texture_set_layout(get_mesh(i)->texture, app->compressed_textures ? TEXTURE_BC1 : TEXTURE_DEFAULT_LAYOUT);
+	}
+	app->render_method = render_method;
+	app->static_batching = static_batching;
+	app->frame_target_time = frame_target_time;
+	app->mipmapping = mipmapping;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -364,6 +692,8 @@ void render(AppState *app)
 void free_resources(AppState *app)
 {
 	window_destroy(&app->win);
+	texture_residency_shutdown();
+	free_batches();
 	free_meshes();
 }
 
@@ -381,9 +711,33 @@ int main(int argc, char **argv)
 
 	AppState app;
 
-	app.is_running = 
-	(argc > 2) ? window_init(&app.win, atoi(argv[1]), atoi(argv[2]))
-                                : window_init(&app.win, 0, 0);
+	// Options come after the window size, if there is one
+	bool has_window_size = argc > 2 && argv[1][0] != '-';
+	int width = has_window_size ? atoi(argv[1]) : 0;
+	int height = has_window_size ? atoi(argv[2]) : 0;
+
+	// Headless runs render a fixed number of frames into the CPU buffers, without a window
+	bool headless = false;
+	const char *output_path = NULL;
+	int num_frames = 1;
+	int render_method = 0;
+	bool async_present = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--headless") == 0)
+			headless = true;
+		else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+			output_path = argv[++i];
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			num_frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--render-method") == 0 && i + 1 < argc)
+			render_method = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--async-present") == 0)
+			async_present = true;
+	}
+
+	app.is_running = headless ? window_init_headless(&app.win, width, height, output_path)
+	                          : window_init(&app.win, width, height);
 
 	if (!app.is_running)
 	{
@@ -393,13 +747,64 @@ int main(int argc, char **argv)
 
 	app_init(&app);
 
+	// Same numbering as the keys that select a rendering method
+	if (render_method >= 1 && render_method <= RENDER_TEXTURED_WIRE_VERTEX + 1)
+		app.render_method = RENDER_WIRE + (render_method - 1);
+
 	srand((unsigned)time(NULL));
 
+	// Cap the memory the textures' texels can take, they're then loaded as they come into view
+	size_t texture_budget = 0;
+	for (int i = 1; i < argc - 1; i++)
+	{
+		if (strcmp(argv[i], "--texture-budget") == 0)
+			texture_budget = (size_t)(atof(argv[i + 1]) * 1024 * 1024);
+	}
+	texture_residency_init(texture_budget);
+
+	// Scale the render size between MIN and MAX (fractions of the full size) to hold the frame rate
+	resolution_controller_init();
+	for (int i = 1; i < argc - 2; i++)
+	{
+		if (strcmp(argv[i], "--resolution-scale") == 0)
+		{
+			resolution_controller.enabled = true;
+			resolution_controller_set_bounds(atof(argv[i + 1]), atof(argv[i + 2]));
+		}
+	}
+
 	setup(&app);
 
+	// Aim for the triangles to cover at most this many screens of pixels, overdraw included
+	for (int i = 1; i < argc - 1; i++)
+	{
+		if (strcmp(argv[i], "--lod-pixel-budget") == 0)
+			lod_controller.pixel_budget = (float)atof(argv[i + 1]);
+	}
+
+	// Compare the texture layouts instead of running interactively
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--benchmark-textures") == 0)
+		{
+			benchmark_texture_layouts(&app);
+			app.is_running = false;
+		}
+	}
+
+	// Rasterize each frame on another thread while this one presents the last one.
+	// There's nothing to present headless
+	if (async_present && !app.win.headless)
+		async_present = async_present_start(&app.win, rasterize_frame, &app);
+
+	// The frame on the screen is the last one drawn
+	bool presented = true;
+
 	while (app.is_running)
 	{
-		process_input(&app);
+		// Headless runs have no window to take input from
+		if (!app.win.headless)
+			process_input(&app);
 
 		// This prevents the next delta_time calculation from including the whole
 		// pause duration (which would otherwise make dt huge on the first update).
@@ -408,16 +813,64 @@ int main(int argc, char **argv)
 
     	app.was_paused = app.paused;
 
+		// Paused with nothing changed, so the frame would be the same picture again. Show
+		// the one already drawn when it isn't on the screen yet, or the window lost it, and
+		// sleep until there's input instead of spinning on identical frames
+		if (frame_unchanged(&app))
+		{
+			if (!presented || app.needs_present)
+			{
+				if (async_present)
+					async_present_again();
+				else
+					window_present_again(&app.win);
+				presented = true;
+				app.needs_present = false;
+			}
+			SDL_WaitEvent(NULL);
+			continue;
+		}
+
 		if (!(app.paused))
 		{
 			update(&app);
 		}
-		render(&app);
+
+		// Whatever update() changed is part of the frame too
+		capture_scene_state(&app, &drawn_state);
+		has_drawn_state = true;
+
+		if (async_present)
+		{
+			async_present_frame();
+			measure_work_time(&app);
+
+			// The frame just drawn goes on the screen with the next one
+			presented = false;
+		}
+		else
+		{
+			render(&app);
+		}
+
+		if (app.win.headless && app.win.frame_index >= num_frames)
+			app.is_running = false;
 	}
 
+	if (async_present)
+		async_present_stop();
+
 	get_app_info(&app);
 	printf("\n\n");
 	get_camera_info();
+	printf("\n\n");
+	get_lod_info();
+	printf("\n\n");
+	get_resolution_info(&app.win);
+	printf("\n\n");
+	get_texture_info();
+	printf("\n\n");
+	get_residency_info();
 
 	free_resources(&app);
 
@@ -5,10 +5,14 @@ void app_init(AppState *app)
 {
     app->paused = false,
 	app->was_paused = false;
+	app->needs_present = false;
 	app->fps = 30;
 	app->frame_target_time = 1000.0f / app->fps; 
 	app->delta_time = 0.0f;
 	app->previous_frame_time = 0.0f;
+	app->work_start = 0;
+	app->work_time = 0.0f;
+	app->raster_time = 0.0f;
 	app->znear = 0.1f;
 	app->zfar = 100.0f;
 	app->aspectx = (float)app->win.width / app->win.height;
@@ -18,6 +22,10 @@ void app_init(AppState *app)
 	app->render_method = RENDER_WIRE;
 	app->cull = true;
 	app->lighting = false;
+	app->static_batching = false;
+	app->mipmapping = true;
+	app->texture_filter = TEXTURE_NEAREST;
+	app->compressed_textures = false;
 }
 
 void get_app_info(AppState *app)
@@ -27,6 +35,7 @@ void get_app_info(AppState *app)
 	printf("Actual FPS: %.1f\n", 1.0f / app->delta_time);
 	printf("Frame target time: %.2fms\n", app->frame_target_time);
 	printf("Delta time: %.4f\n", app->delta_time);
+	printf("Work time: %.2fms\n", app->work_time);
 	printf("Z-Near: %.2f\n", app->znear);
 	printf("Z-Far: %.2f\n", app->zfar);
 	printf("Aspect Ratio: %f\n", app->aspectx);
@@ -1,16 +1,22 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "display.h"
+#include "texture.h"
 
 typedef struct AppState {
     bool is_running;
     bool paused;
     bool was_paused;
+    bool needs_present; // the window was uncovered or resized, and has to be shown the last frame again
     int fps;
     float frame_target_time;
     float delta_time;
     float previous_frame_time;
+    uint64_t work_start; // Performance counter when this frame's update started
+    float work_time;     // Milliseconds spent updating and rendering the last frame
+    float raster_time;   // Milliseconds spent rasterizing the last frame, part of work_time
     float znear;    // Near Clipping Plane
     float zfar;     // Far Clipping Plane
     float aspectx;  // (width / height)
@@ -20,6 +26,10 @@ typedef struct AppState {
     enum Render_Method render_method;
     bool cull;
     bool lighting;
+    bool static_batching; // Draw static meshes through merged per-texture batches
+    bool mipmapping;      // Sample minified triangles from a smaller mip level
+    enum Texture_Filter texture_filter; // Nearest or bilinear texture sampling
+    bool compressed_textures; // Keep textures as BC1 blocks instead of 4x4 tiles of RGBA texels
     Window win;
 } AppState;
 
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <SDL2/SDL.h>
+#include "async_present.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Asynchronous present
+///////////////////////////////////////////////////////////////////////////////
+// Two streaming textures take turns being the back buffer. While the raster
+// thread draws frame N into the locked back texture, the main thread copies
+// the front texture (frame N - 1) to the screen and presents it, which is
+// where the wait for vsync and the driver's upload go. Once frame N is
+// drawn, the textures swap roles.
+//
+// Only the main thread ever calls into SDL's renderer: it locks the back
+// texture before handing it over and unlocks it after taking it back. The
+// raster thread only writes pixels. Handing a frame over and back is a
+// semaphore post each way, and each buffer only ever has one owner at a time,
+// so nothing is ever shared under a lock.
+//
+// Frames go on screen one frame later than with the synchronous present,
+// in exchange for the present overlapping the next frame's rasterization.
+///////////////////////////////////////////////////////////////////////////////
+
+static Window *window = NULL;
+static raster_func_t raster_func = NULL;
+static void *raster_data = NULL;
+
+static SDL_Texture *textures[2];
+static int back = 0;          // texture the next frame is drawn into
+static bool has_front = false; // the other texture holds a finished frame to present
+static int front_width = 0;    // render size the front texture's frame was drawn at
+static int front_height = 0;
+
+static SDL_Thread *thread = NULL;
+static SDL_sem *frame_requested = NULL;
+static SDL_sem *frame_finished = NULL;
+static SDL_atomic_t quit;
+
+static int raster_thread(void *data)
+{
+    for (;;)
+    {
+        SDL_SemWait(frame_requested);
+        if (SDL_AtomicGet(&quit))
+            break;
+
+        raster_func(raster_data);
+        SDL_SemPost(frame_finished);
+    }
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Start the raster thread. The window's texture becomes the first back
+// buffer, and a second one the same size is created to alternate with it.
+// Both are the window's full size, whatever its render size is.
+///////////////////////////////////////////////////////////////////////////////
+bool async_present_start(Window *w, raster_func_t raster, void *data)
+{
+    textures[0] = w->color_buffer_texture;
+    textures[1] = SDL_CreateTexture(
+        w->renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING,
+        w->max_width, w->max_height
+    );
+    if (textures[1] == NULL)
+    {
+        fprintf(stderr, "Async present disabled, SDL_CreateTexture failed: %s\n", SDL_GetError());
+        return false;
+    }
+
+    window = w;
+    raster_func = raster;
+    raster_data = data;
+    back = 0;
+    has_front = false;
+
+    SDL_AtomicSet(&quit, 0);
+    frame_requested = SDL_CreateSemaphore(0);
+    frame_finished = SDL_CreateSemaphore(0);
+    thread = SDL_CreateThread(raster_thread, "raster", NULL);
+
+    return true;
+}
+
+// Present the last frame drawn, it's in the front texture
+static void present_front(void)
+{
+    if (!has_front)
+        return;
+
+    SDL_Rect src = { 0, 0, front_width, front_height };
+    SDL_Rect dst = { 0, 0, window->screen_w, window->screen_h };
+    SDL_RenderCopy(window->renderer, textures[1 - back], &src, &dst);
+    SDL_RenderPresent(window->renderer);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Rasterize a frame on the raster thread and present the previous one in
+// the meantime. Returns once the new frame is drawn, so the caller can
+// update the scene for the next one.
+///////////////////////////////////////////////////////////////////////////////
+void async_present_frame(void)
+{
+    void *pixels;
+    int pitch;
+    bool locked = SDL_LockTexture(textures[back], NULL, &pixels, &pitch) == 0;
+    if (locked)
+    {
+        window->color_buffer_texture = textures[back];
+        window->color_buffer = (uint32_t*)pixels;
+        window->pitch = pitch / (int)sizeof(uint32_t);
+        SDL_SemPost(frame_requested);
+    }
+    else
+    {
+        fprintf(stderr, "SDL_LockTexture failed: %s\n", SDL_GetError());
+    }
+
+    present_front();
+
+    if (!locked)
+        return;
+
+    SDL_SemWait(frame_finished);
+    SDL_UnlockTexture(textures[back]);
+    window->color_buffer = NULL;
+    window->frame_index++;
+
+    has_front = true;
+    front_width = window->width;
+    front_height = window->height;
+    back = 1 - back;
+}
+
+// Present the last frame drawn again, without drawing a new one
+void async_present_again(void)
+{
+    present_front();
+}
+
+// Present the last frame drawn, stop the raster thread and go back to the window's one texture
+void async_present_stop(void)
+{
+    if (thread == NULL)
+        return;
+
+    present_front();
+
+    SDL_AtomicSet(&quit, 1);
+    SDL_SemPost(frame_requested);
+    SDL_WaitThread(thread, NULL);
+    thread = NULL;
+
+    SDL_DestroySemaphore(frame_requested);
+    SDL_DestroySemaphore(frame_finished);
+
+    // The window destroys its own texture, whichever was drawn into last
+    window->color_buffer_texture = textures[1 - back];
+    SDL_DestroyTexture(textures[back]);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdbool.h>
+#include "display.h"
+
+// Draws one frame into the window's color buffer, runs on the raster thread
+typedef void (*raster_func_t)(void *data);
+
+bool async_present_start(Window *w, raster_func_t raster, void *data);
+void async_present_frame(void);
+void async_present_again(void);
+void async_present_stop(void);
@@ -0,0 +1,353 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+#include "atlas.h"
+#include "mesh.h"
+#include "array.h"
+#include "texture_registry.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Texture atlases
+///////////////////////////////////////////////////////////////////////////////
+// Every mesh is loaded with a texture of its own. Once the scene is loaded we
+// copy the textures that can share one into a few atlas pages, and remap each
+// mesh's UVs into its texture's rectangle on the page. Meshes on the same page
+// then have the same texture, so static batching merges them across meshes,
+// and the rasterizer keeps sampling from one small set of hot pages.
+//
+// Only textures every mesh clamps, with UVs that all stay inside 0-1, can be
+// packed, repeating a texture needs the whole texture to wrap around. Textures
+// the residency manager loads on demand aren't in memory yet, so they keep
+// their own.
+//
+// A page's mip chain stops at ATLAS_MAX_MIPS, while the padding still keeps
+// the textures apart. Far away meshes sample the last of those levels and
+// alias a little, rather than blend in their neighbors on the page.
+///////////////////////////////////////////////////////////////////////////////
+
+#define MAX_NUM_ATLAS_RECTS MAX_NUM_MESHES
+
+// Page widths tried when packing, the narrowest page that holds the most textures wins
+#define ATLAS_WIDTH_STEP 64
+
+// A texture's padded rectangle on a page
+typedef struct
+{
+    texture_t *texture;
+    int width;
+    int height;
+    int x;
+    int y;
+    int page;       // -1 until it has been placed
+    bool packable;
+} atlas_rect_t;
+
+// Skyline packing: the pages fill up from the top, and the skyline is the
+// bottom edge of everything placed so far, as runs of equal height
+typedef struct
+{
+    int x;
+    int y;
+    int width;
+} skyline_node_t;
+
+typedef struct
+{
+    skyline_node_t nodes[MAX_NUM_ATLAS_RECTS + 1];
+    int num_nodes;
+    int width;
+} skyline_t;
+
+static void skyline_init(skyline_t *skyline, int width)
+{
+    skyline->nodes[0] = (skyline_node_t){0, 0, width};
+    skyline->num_nodes = 1;
+    skyline->width = width;
+}
+
+// Find the highest spot (lowest y) a width x height rectangle fits, leftmost on ties
+static bool skyline_find(const skyline_t *skyline, int width, int height, int *out_node, int *out_x, int *out_y)
+{
+    int best_y = INT_MAX;
+
+    for (int i = 0; i < skyline->num_nodes; i++)
+    {
+        int x = skyline->nodes[i].x;
+        if (x + width > skyline->width)
+            break;
+
+        // The rectangle rests on the highest run under it
+        int y = 0;
+        for (int j = i, covered = 0; covered < width; j++)
+        {
+            y = skyline->nodes[j].y > y ? skyline->nodes[j].y : y;
+            covered += skyline->nodes[j].width;
+        }
+
+        if (y + height <= ATLAS_PAGE_SIZE && y < best_y)
+        {
+            best_y = y;
+            *out_node = i;
+            *out_x = x;
+            *out_y = y;
+        }
+    }
+
+    return best_y != INT_MAX;
+}
+
+// Raise the skyline over a rectangle placed at the start of the given node
+static void skyline_insert(skyline_t *skyline, int node, int x, int y, int width, int height)
+{
+    for (int i = skyline->num_nodes; i > node; i--)
+        skyline->nodes[i] = skyline->nodes[i - 1];
+    skyline->nodes[node] = (skyline_node_t){x, y + height, width};
+    skyline->num_nodes++;
+
+    // Trim or drop the runs the new one now covers
+    int i = node + 1;
+    while (i < skyline->num_nodes && skyline->nodes[i].x < x + width)
+    {
+        int overlap = x + width - skyline->nodes[i].x;
+        if (overlap < skyline->nodes[i].width)
+        {
+            skyline->nodes[i].x += overlap;
+            skyline->nodes[i].width -= overlap;
+            break;
+        }
+
+        for (int j = i; j < skyline->num_nodes - 1; j++)
+            skyline->nodes[j] = skyline->nodes[j + 1];
+        skyline->num_nodes--;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Place as many unplaced rectangles as fit on a page of the given width, in
+// order (tallest first). Returns how many were placed, along with the page's
+// used width and height. When commit is false the rectangles are left as is.
+///////////////////////////////////////////////////////////////////////////////
+static int pack_page(atlas_rect_t *rects, int num_rects, int page, int page_width, bool commit, int *out_width, int *out_height)
+{
+    skyline_t skyline;
+    skyline_init(&skyline, page_width);
+
+    int num_placed = 0;
+    *out_width = 0;
+    *out_height = 0;
+
+    for (int i = 0; i < num_rects; i++)
+    {
+        atlas_rect_t *rect = &rects[i];
+        if (!rect->packable || rect->page >= 0)
+            continue;
+
+        int node, x, y;
+        if (!skyline_find(&skyline, rect->width, rect->height, &node, &x, &y))
+            continue;
+
+        skyline_insert(&skyline, node, x, y, rect->width, rect->height);
+        num_placed++;
+        *out_width = x + rect->width > *out_width ? x + rect->width : *out_width;
+        *out_height = y + rect->height > *out_height ? y + rect->height : *out_height;
+
+        if (commit)
+        {
+            rect->x = x;
+            rect->y = y;
+            rect->page = page;
+        }
+    }
+
+    return num_placed;
+}
+
+static int compare_rect_height(const void *a, const void *b)
+{
+    const atlas_rect_t *rect_a = a;
+    const atlas_rect_t *rect_b = b;
+    if (rect_a->height != rect_b->height)
+        return rect_b->height - rect_a->height;
+    return rect_b->width - rect_a->width;
+}
+
+// Copy a texture into its rectangle on the page, the padding repeats the edge texels
+static void copy_into_page(const atlas_rect_t *rect, mip_level_t *page)
+{
+    const mip_level_t *src = &rect->texture->mips[0];
+    for (int y = 0; y < rect->height; y++)
+    {
+        int src_y = y - ATLAS_PADDING;
+        src_y = src_y < 0 ? 0 : (src_y >= src->height ? src->height - 1 : src_y);
+
+        for (int x = 0; x < rect->width; x++)
+        {
+            int src_x = x - ATLAS_PADDING;
+            src_x = src_x < 0 ? 0 : (src_x >= src->width ? src->width - 1 : src_x);
+
+            page->texels[(page->width * (rect->y + y)) + rect->x + x] = mip_level_fetch(src, src_x, src_y);
+        }
+    }
+}
+
+static texture_t* create_page(atlas_rect_t *rects, int num_rects, int page_index, int width, int height)
+{
+    texture_t *page = calloc(1, sizeof(texture_t));
+    page->png = NULL;
+    page->layout = TEXTURE_LINEAR;
+    page->mips[0] = (mip_level_t){
+        .texels = calloc((size_t)width * height, sizeof(uint32_t)),
+        .width = width,
+        .height = height,
+        .tiles_x = (width + TEXTURE_TILE_MASK) >> TEXTURE_TILE_SHIFT,
+        .layout = TEXTURE_LINEAR
+    };
+    page->num_mips = 1;
+    page->ref_count = 1;
+
+    for (int i = 0; i < num_rects; i++)
+    {
+        if (rects[i].page == page_index)
+            copy_into_page(&rects[i], &page->mips[0]);
+    }
+
+    // Same as a freshly loaded texture, build the chain row by row then convert it. Only
+    // the levels the padding keeps apart, far away meshes sample the last one
+    texture_build_mips(page, ATLAS_MAX_MIPS);
+    texture_set_layout(page, TEXTURE_DEFAULT_LAYOUT);
+
+    return page;
+}
+
+// Point every mesh that used the rectangle's texture at the page instead, and
+// the texture's paths in the registry too, so loading the PNG again finds it there
+static void move_meshes_to_page(const atlas_rect_t *rect, texture_t *page, const mip_level_t *page_level)
+{
+    // The last mesh to let go frees the texture, keep its size
+    texture_region_t region = {
+        rect->x + ATLAS_PADDING, rect->y + ATLAS_PADDING,
+        rect->texture->mips[0].width, rect->texture->mips[0].height
+    };
+    texture_registry_move_to_page(rect->texture, page, region.x, region.y);
+
+    for (int mesh_index = 0; mesh_index < get_num_meshes(); mesh_index++)
+    {
+        mesh_t *mesh = get_mesh(mesh_index);
+        if (mesh->texture != rect->texture)
+            continue;
+
+        mesh_remap_uvs(mesh, &region, page_level);
+
+        page->ref_count++;
+        mesh->texture = page;
+        free_texture(rect->texture);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Pack the textures of every loaded mesh into as few pages as will hold them.
+// Each page tries every width from the widest texture up to the page size
+// and keeps the one that places the most textures in the smallest area, so a
+// tall texture doesn't leave a page mostly empty. Rectangles are rounded up
+// to whole tiles, which keeps every texture tile aligned on its page.
+// Needs to run before build_static_batches(), which groups by texture.
+///////////////////////////////////////////////////////////////////////////////
+void build_texture_atlases(void)
+{
+    atlas_rect_t rects[MAX_NUM_ATLAS_RECTS];
+    int num_rects = 0;
+
+    for (int mesh_index = 0; mesh_index < get_num_meshes(); mesh_index++)
+    {
+        mesh_t *mesh = get_mesh(mesh_index);
+        if (mesh->texture == NULL)
+            continue;
+
+        atlas_rect_t *rect = NULL;
+        for (int i = 0; i < num_rects; i++)
+        {
+            if (rects[i].texture == mesh->texture)
+                rect = &rects[i];
+        }
+
+        if (rect == NULL)
+        {
+            const mip_level_t *level = &mesh->texture->mips[0];
+            rect = &rects[num_rects++];
+            rect->texture = mesh->texture;
+            rect->width = ((level->width + TEXTURE_TILE_MASK) & ~TEXTURE_TILE_MASK) + 2 * ATLAS_PADDING;
+            rect->height = ((level->height + TEXTURE_TILE_MASK) & ~TEXTURE_TILE_MASK) + 2 * ATLAS_PADDING;
+            rect->page = -1;
+            rect->packable = mesh->texture->source == NULL &&
+                rect->width <= ATLAS_PAGE_SIZE && rect->height <= ATLAS_PAGE_SIZE;
+        }
+
+        if (mesh->texture_wrap != TEXTURE_CLAMP || !mesh_uvs_in_unit_range(mesh))
+            rect->packable = false;
+    }
+
+    int num_packable = 0;
+    for (int i = 0; i < num_rects; i++)
+    {
+        if (rects[i].packable)
+            num_packable++;
+    }
+
+    // A single texture has nothing to share a page with
+    if (num_packable < 2)
+        return;
+
+    qsort(rects, num_rects, sizeof(atlas_rect_t), compare_rect_height);
+
+    int widest = 0;
+    for (int i = 0; i < num_rects; i++)
+    {
+        if (rects[i].packable && rects[i].width > widest)
+            widest = rects[i].width;
+    }
+
+    for (int page_index = 0; page_index < MAX_NUM_ATLAS_PAGES && num_packable > 0; page_index++)
+    {
+        int best_width = ATLAS_PAGE_SIZE;
+        int best_placed = 0;
+        long best_area = LONG_MAX;
+
+        for (int page_width = widest; ; page_width += ATLAS_WIDTH_STEP)
+        {
+            page_width = page_width > ATLAS_PAGE_SIZE ? ATLAS_PAGE_SIZE : page_width;
+
+            int used_width, used_height;
+            int num_placed = pack_page(rects, num_rects, page_index, page_width, false, &used_width, &used_height);
+            long area = (long)used_width * used_height;
+            if (num_placed > best_placed || (num_placed == best_placed && area < best_area))
+            {
+                best_width = page_width;
+                best_placed = num_placed;
+                best_area = area;
+            }
+
+            if (page_width == ATLAS_PAGE_SIZE)
+                break;
+        }
+
+        // Whatever is left over would be alone on its page
+        if (best_placed < 2)
+            break;
+
+        int width, height;
+        pack_page(rects, num_rects, page_index, best_width, true, &width, &height);
+        num_packable -= best_placed;
+
+        texture_t *page = create_page(rects, num_rects, page_index, width, height);
+
+        // The UVs are remapped against the page's full size, which the layout change didn't touch
+        for (int i = 0; i < num_rects; i++)
+        {
+            if (rects[i].page == page_index)
+                move_meshes_to_page(&rects[i], page, &page->mips[0]);
+        }
+
+        // Only the meshes hold on to the page now
+        free_texture(page);
+    }
+}
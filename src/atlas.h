@@ -0,0 +1,19 @@
+#pragma once
+
+#include "texture.h"
+
+// Largest atlas page, a texture that doesn't fit in one with its padding keeps its own texture
+#define ATLAS_PAGE_SIZE 2048
+
+// Gutter of repeated edge texels around every packed texture, so bilinear taps and the first
+// mip levels never reach a neighbor. A multiple of the tile size, so no 4x4 tile or BC1 block
+// ever holds texels of two different textures
+#define ATLAS_PADDING 4
+
+// Mip levels built for a page, log2(ATLAS_PADDING) + 1. A texel of level n averages 2^n x 2^n
+// texels of level 0, so past level 2 the padding is averaged away and texels blend neighbors
+#define ATLAS_MAX_MIPS 3
+
+#define MAX_NUM_ATLAS_PAGES 4
+
+void build_texture_atlases(void);
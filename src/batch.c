@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "batch.h"
+#include "mesh.h"
+#include "array.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Static batching
+///////////////////////////////////////////////////////////////////////////////
+// Meshes that never move don't need a world matrix every frame. We bake
+// their world transforms into the vertices once, and merge every static mesh
+// that uses the same texture into a single batch, so a scene full of static
+// props only goes through the pipeline once per texture.
+//
+// Batches always hold full detail (LOD 0), since one batch covers meshes at
+// many different distances.
+///////////////////////////////////////////////////////////////////////////////
+
+#define MAX_NUM_BATCHES 10
+static batch_t batches[MAX_NUM_BATCHES];
+static int batch_count = 0;
+
+static batch_t* find_or_add_batch(texture_t *texture, enum Texture_Wrap texture_wrap)
+{
+    for (int i = 0; i < batch_count; i++)
+    {
+        if (batches[i].texture == texture && batches[i].texture_wrap == texture_wrap)
+            return &batches[i];
+    }
+
+    if (batch_count >= MAX_NUM_BATCHES)
+        return NULL;
+
+    batch_t *batch = &batches[batch_count++];
+    batch->texture = texture;
+    batch->texture_wrap = texture_wrap;
+    batch->vertices = NULL;
+    batch->faces = NULL;
+    batch->num_meshes = 0;
+    return batch;
+}
+
+void build_static_batches(void)
+{
+    free_batches();
+
+    // Bake the full World Matrix, including any parents
+    update_mesh_transforms();
+
+    for (int mesh_index = 0; mesh_index < get_num_meshes(); mesh_index++)
+    {
+        mesh_t *mesh = get_mesh(mesh_index);
+        if (!mesh->is_static)
+            continue;
+
+        // A static mesh still moves with a parent that isn't static, so it can't be baked
+        bool parent_moves = false;
+        for (int ancestor = mesh_get_parent(mesh_index); ancestor >= 0; ancestor = mesh_get_parent(ancestor))
+        {
+            if (!get_mesh(ancestor)->is_static)
+                parent_moves = true;
+        }
+        if (parent_moves)
+        {
+            mesh->is_static = false;
+            continue;
+        }
+
+        batch_t *batch = find_or_add_batch(mesh->texture, mesh->texture_wrap);
+        if (!batch)
+        {
+            // Out of batches, this mesh goes through the normal pipeline instead
+            mesh->is_static = false;
+            continue;
+        }
+
+        mat4_t world_matrix = mesh_get_world_matrix(mesh);
+
+        // The faces are 1-based, so this mesh's first vertex comes right after the batch's last one
+        int index_offset = array_length(batch->vertices);
+
+        int num_vertices = array_length(mesh->vertices);
+        for (int i = 0; i < num_vertices; i++)
+        {
+            vec4_t world_vertex = mat4_mul_vec4(world_matrix, vec4_from_vec3(mesh->vertices[i]));
+            array_push(batch->vertices, vec3_from_vec4(world_vertex));
+        }
+
+        int num_faces = array_length(mesh->faces);
+        for (int i = 0; i < num_faces; i++)
+        {
+            face_t face = mesh->faces[i];
+            face.a += index_offset;
+            face.b += index_offset;
+            face.c += index_offset;
+            array_push(batch->faces, face);
+        }
+
+        batch->num_meshes++;
+        mesh->lod_level = 0;
+    }
+}
+
+batch_t* get_batch(int batch_index)
+{
+    return &batches[batch_index];
+}
+
+int get_num_batches(void)
+{
+    return batch_count;
+}
+
+void free_batches(void)
+{
+    for (int i = 0; i < batch_count; i++)
+    {
+        array_free(batches[i].vertices);
+        array_free(batches[i].faces);
+        batches[i].vertices = NULL;
+        batches[i].faces = NULL;
+    }
+    batch_count = 0;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "vector.h"
+#include "triangle.h"
+#include "texture.h"
+
+// All the static meshes that share a texture, merged into one world space vertex stream
+typedef struct {
+   texture_t* texture; // texture shared by every face in the batch
+   enum Texture_Wrap texture_wrap; // and the wrap mode every mesh in the batch samples it with
+   vec3_t* vertices;   // dynamic array of world space vertices
+   face_t* faces;      // dynamic array of faces, indexing into vertices
+   int num_meshes;     // how many meshes were merged into this batch
+} batch_t;
+
+void build_static_batches(void);
+batch_t* get_batch(int batch_index);
+int get_num_batches(void);
+void free_batches(void);
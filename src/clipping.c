@@ -91,6 +91,20 @@ void triangles_from_polygon(polygon_t *polygon, triangle_t triangles[], int *num
 	*num_triangles = polygon->num_vertices - 2;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// True unless a camera space sphere is entirely behind one of the frustum planes
+///////////////////////////////////////////////////////////////////////////////
+bool sphere_in_frustum(vec3_t center, float radius)
+{
+	for (int plane = 0; plane < NUM_PLANES; plane++)
+	{
+		float distance = vec3_dot(vec3_sub(center, frustum_planes[plane].point), frustum_planes[plane].normal);
+		if (distance < -radius)
+			return false;
+	}
+	return true;
+}
+
 float float_lerp(float a, float b, float t)
 {
 	return a + t * (b - a);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdbool.h>
 #include "vector.h"
 #include "triangle.h"
 
@@ -35,4 +36,5 @@ void init_frustum_planes(float fovx, float fovy, float znear, float zfar);
 polygon_t create_polygon_from_triangle(vec3_t v0, vec3_t v1, vec3_t v2, tex2_t t0, tex2_t t1, tex2_t t2);
 void triangles_from_polygon(polygon_t *polygon, triangle_t triangles[], int *num_triangles);
 void clip_polygon_against_plane(polygon_t *polygon, int plane);
-void clip_polygon(polygon_t *polygon);
\ No newline at end of file
+void clip_polygon(polygon_t *polygon);
+bool sphere_in_frustum(vec3_t center, float radius);
\ No newline at end of file
@@ -1,8 +1,15 @@
 #include <time.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "display.h"
 #include "app.h"
 #include "mathdefs.h"
+#include "image_writer.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 uint32_t colors[NUM_COLORS] = {
     RED,
@@ -39,6 +46,29 @@ static int allocated = 0;
 static float *ax = NULL;  // subpixel accumulator X
 static float *ay = NULL;  // subpixel accumulator Y
 
+// Tiles covering the render size
+static void window_count_tiles(Window *w)
+{
+    w->tiles_x = (w->width + WINDOW_TILE_WIDTH - 1) >> WINDOW_TILE_WIDTH_SHIFT;
+    w->tiles_y = (w->height + WINDOW_TILE_HEIGHT - 1) >> WINDOW_TILE_HEIGHT_SHIFT;
+}
+
+// Every tile starts out uncleared, the first frame clears them like any other.
+// The flags are allocated for the full size, a smaller render size uses fewer of them
+static void window_init_tiles(Window *w)
+{
+    w->max_width = w->width;
+    w->max_height = w->height;
+    window_count_tiles(w);
+    w->tile_cleared = (uint8_t*)calloc(w->tiles_x * w->tiles_y, sizeof(uint8_t));
+    w->clear_color = BLACK;
+    w->background = NULL;
+    w->background_rows = NULL;
+    w->background_width = 0;
+    w->background_height = 0;
+    w->clear_to_background = false;
+}
+
 bool window_init(Window* w, int req_w, int req_h)
 {
     SDL_Init(SDL_INIT_EVERYTHING);
@@ -47,6 +77,10 @@ bool window_init(Window* w, int req_w, int req_h)
     SDL_DisplayMode dm;
     SDL_GetCurrentDisplayMode(0, &dm);
 
+    w->headless = false;
+    w->output_path = NULL;
+    w->frame_index = 0;
+
     // Always create a fullscreen window at the native display size
     w->screen_w = dm.w;
     w->screen_h = dm.h;
@@ -75,9 +109,12 @@ bool window_init(Window* w, int req_w, int req_h)
     w->renderer = SDL_CreateRenderer(w->sdl_window, -1, SDL_RENDERER_ACCELERATED);
     if (!w->renderer) return false;
 
-    // Allocate CPU-side buffers using INTERNAL size
-    w->color_buffer = (uint32_t*)malloc(sizeof(uint32_t) * w->width * w->height);
+    // Allocate the CPU-side depth buffer using INTERNAL size. There's no CPU color buffer,
+    // every frame is rasterized straight into the locked streaming texture
+    w->color_buffer = NULL;
+    w->pitch        = 0;
     w->z_buffer     = (float*)malloc(sizeof(float) * w->width * w->height);
+    window_init_tiles(w);
 
     // Create the streaming texture at the INTERNAL size
     w->color_buffer_texture = SDL_CreateTexture(
@@ -85,30 +122,160 @@ bool window_init(Window* w, int req_w, int req_h)
         w->width, w->height
     );
 
-    return w->renderer && w->color_buffer && w->z_buffer && w->color_buffer_texture;
+    return w->renderer && w->z_buffer && w->tile_cleared && w->color_buffer_texture;
+}
+
+// Same buffers as window_init, but no window, renderer or texture.
+// Only the timer is initialized, the frame limiter and profiling still read it
+bool window_init_headless(Window* w, int req_w, int req_h, const char *output_path)
+{
+    SDL_Init(SDL_INIT_TIMER);
+
+    w->sdl_window = NULL;
+    w->renderer = NULL;
+    w->color_buffer_texture = NULL;
+    w->headless = true;
+    w->output_path = output_path;
+    w->frame_index = 0;
+
+    w->width  = (req_w > 0 && req_h > 0) ? req_w : 1280;
+    w->height = (req_w > 0 && req_h > 0) ? req_h : 720;
+    w->screen_w = w->width;
+    w->screen_h = w->height;
+
+    // Without a texture to lock, the color buffer is the only place frames can go
+    w->color_buffer = (uint32_t*)malloc(sizeof(uint32_t) * w->width * w->height);
+    w->pitch        = w->width;
+    w->z_buffer     = (float*)malloc(sizeof(float) * w->width * w->height);
+    window_init_tiles(w);
+
+    return w->color_buffer && w->z_buffer && w->tile_cleared;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Point the color buffer at this frame's pixels. Windowed, that's the
+// streaming texture's memory, locked until the frame is presented, so the
+// rasterizer writes straight into it and nothing is copied at present.
+// Its rows are however far apart SDL says they are, not always width.
+///////////////////////////////////////////////////////////////////////////////
+bool window_begin_frame(Window *w)
+{
+    if (w->headless)
+        return true;
+
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(w->color_buffer_texture, NULL, &pixels, &pitch) != 0)
+    {
+        fprintf(stderr, "SDL_LockTexture failed: %s\n", SDL_GetError());
+        return false;
+    }
+
+    w->color_buffer = (uint32_t*)pixels;
+    w->pitch = pitch / (int)sizeof(uint32_t);
+    return true;
 }
 
 void render_color_buffer(Window *w)
 {
-    // Copy pixel data from the CPU buffer into the SDL texture
-    SDL_UpdateTexture(
-        w->color_buffer_texture,
-        NULL,
-        w->color_buffer,
-        (int)(w->width * sizeof(uint32_t))
-    );
+    // Hand the frame's pixels back to SDL, they're already in the texture
+    SDL_UnlockTexture(w->color_buffer_texture);
+    w->color_buffer = NULL;
 
-    // Upscale to fill the fullscreen window (DISPLAY size)
+    // Only the top left of the texture was drawn, upscale it to fill the fullscreen window (DISPLAY size)
+    SDL_Rect src = { 0, 0, w->width, w->height };
     SDL_Rect dst = { 0, 0, w->screen_w, w->screen_h };
     // Queue the texture to be drawn on the screen (but not shown yet)
-    SDL_RenderCopy(w->renderer, w->color_buffer_texture, NULL, &dst);
+    SDL_RenderCopy(w->renderer, w->color_buffer_texture, &src, &dst);
+}
+
+// Fill in the frame number if the path has a %d (with an optional zero padded width, like %04d)
+static void format_frame_path(char *path, size_t path_size, const char *pattern, int frame_index)
+{
+    const char *percent = strchr(pattern, '%');
+    const char *spec = percent ? percent + 1 : NULL;
+    while (spec && *spec >= '0' && *spec <= '9')
+        spec++;
+
+    if (spec == NULL || *spec != 'd' || strchr(spec, '%'))
+    {
+        snprintf(path, path_size, "%s", pattern);
+        return;
+    }
+
+    // Only ever hand snprintf the one integer conversion it was checked to be
+    int width = atoi(percent + 1);
+    snprintf(path, path_size, "%.*s%0*d%s", (int)(percent - pattern), pattern, width, frame_index, spec + 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Show the finished frame. Windowed, it's uploaded and presented through
+// SDL. Headless, it's written to the output path, if there is one.
+///////////////////////////////////////////////////////////////////////////////
+void window_present(Window *w)
+{
+    if (w->headless)
+    {
+        if (w->output_path)
+        {
+            char path[1024];
+            format_frame_path(path, sizeof(path), w->output_path, w->frame_index);
+            if (!write_image(path, w->color_buffer, w->width, w->height, w->pitch * (int)sizeof(uint32_t)))
+                fprintf(stderr, "Could not write frame %d to %s\n", w->frame_index, path);
+        }
+    }
+    else
+    {
+        // Unlock the texture and queue it to be drawn
+        render_color_buffer(w);
+
+        // Draw the new frame
+        SDL_RenderPresent(w->renderer);
+    }
+
+    w->frame_index++;
+}
+
+// Show the last frame presented once more, without drawing it again. The texture still holds it
+void window_present_again(Window *w)
+{
+    if (w->headless || w->frame_index == 0)
+        return;
+
+    SDL_Rect src = { 0, 0, w->width, w->height };
+    SDL_Rect dst = { 0, 0, w->screen_w, w->screen_h };
+    SDL_RenderCopy(w->renderer, w->color_buffer_texture, &src, &dst);
+    SDL_RenderPresent(w->renderer);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw the next frames at width x height, up to the size the window was
+// created with. Nothing is reallocated: the frame is the top left of the
+// same buffers, with the color buffer's rows still pitch apart and the
+// depth buffer's packed at the new width. Both are cleared for every frame
+// anyway, so nothing needs copying over. Only the background layer is
+// rendered again, the next time it's cleared to.
+///////////////////////////////////////////////////////////////////////////////
+void window_set_render_size(Window *w, int width, int height)
+{
+    if (width < 1) width = 1;
+    if (height < 1) height = 1;
+    if (width > w->max_width) width = w->max_width;
+    if (height > w->max_height) height = w->max_height;
+    if (width == w->width && height == w->height)
+        return;
+
+    w->width = width;
+    w->height = height;
+    window_count_tiles(w);
 }
 
 void draw_pixel(Window *w, int x, int y, uint32_t color)
 {
     if (x < 0 || x >= w->width || y < 0 || y >= w->height)
         return;
-    w->color_buffer[(w->width * y) + x] = color;
+    window_touch_pixel(w, x, y);
+    w->color_buffer[(w->pitch * y) + x] = color;
 }
 
 void draw_rectangle(Window *w, int x, int y, int width, int height, uint32_t color)
@@ -342,19 +509,180 @@ void draw_filled_circle(Window *w, int cx, int cy, int rad, uint32_t color)
     }
 }
 
+// Fill count pixels with one color, 4 at a time with SSE2
+static void fill_pixels(uint32_t *pixels, uint32_t color, int count)
+{
+    int i = 0;
+#ifdef __SSE2__
+    __m128i colors = _mm_set1_epi32((int)color);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i*)&pixels[i], colors);
+#endif
+    for (; i < count; i++)
+        pixels[i] = color;
+}
+
+// Fill count depths with one value, 4 at a time with SSE2
+static void fill_depths(float *depths, float depth, int count)
+{
+    int i = 0;
+#ifdef __SSE2__
+    __m128 values = _mm_set1_ps(depth);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(&depths[i], values);
+#endif
+    for (; i < count; i++)
+        depths[i] = depth;
+}
+
 void clear_color_buffer(Window *w, uint32_t color)
 {
-    for (int i = 0; i < w->width * w->height; i++)
+    // Rows are only contiguous when the pitch is the width
+    if (w->pitch == w->width)
+    {
+        fill_pixels(w->color_buffer, color, w->width * w->height);
+        return;
+    }
+
+    for (int y = 0; y < w->height; y++)
     {
-        w->color_buffer[i] = color;
+        fill_pixels(&w->color_buffer[w->pitch * y], color, w->width);
     }
 }
 
 void clear_z_buffer(Window *w)
 {
-    for (int i = 0; i <  w->width * w->height; i++)
+    fill_depths(w->z_buffer, 1.0f, w->width * w->height);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Lazy clears
+///////////////////////////////////////////////////////////////////////////////
+// Instead of two full-frame passes clearing the color and depth buffers up
+// front, window_clear only forgets which 128x8 tiles have been cleared.
+// Whatever draws first into a tile (through window_touch_pixel) clears that
+// tile's color and depth right before, while they're about to be in cache
+// anyway. The tiles nothing drew into only ever get their color filled in,
+// by window_fill_untouched_tiles once the frame is done, and their depth
+// never, since nothing reads it.
+//
+// Tiles are wide and short because every row of a tile is on a different
+// page of each buffer. 32 rows of color and depth is more pages than the
+// TLB holds, and made clearing square tiles several times slower than
+// clearing the whole frame.
+//
+// With window_clear_background the tiles come out of a prerendered
+// background layer instead of one color, so the dotted grid costs nothing
+// per frame beyond copying the few rows that have dots in them, rather than
+// a pass over the whole screen testing every pixel.
+///////////////////////////////////////////////////////////////////////////////
+void window_clear(Window *w, uint32_t color)
+{
+    w->clear_color = color;
+    w->clear_to_background = false;
+    memset(w->tile_cleared, 0, w->tiles_x * w->tiles_y);
+}
+
+// The clear color with a dot every dot_spacing pixels, the same dots as draw_dotted_grid
+// over the whole window, leaving out the last row and column like render() always did
+static void build_background(Window *w, uint32_t color, int dot_spacing, uint32_t dot_color)
+{
+    // Allocated once for the full size, so a new render size doesn't have to wait on the allocator
+    if (w->background == NULL)
+    {
+        w->background = (uint32_t*)malloc(sizeof(uint32_t) * w->max_width * w->max_height);
+        w->background_rows = (uint8_t*)malloc(w->max_height);
+    }
+    fill_pixels(w->background, color, w->width * w->height);
+    memset(w->background_rows, 0, w->height);
+
+    for (int y = 0; y < w->height - 1; y += dot_spacing)
+    {
+        for (int x = 0; x < w->width - 1; x += dot_spacing)
+        {
+            w->background[(w->width * y) + x] = dot_color;
+            w->background_rows[y] = 1;
+        }
+    }
+
+    w->background_width = w->width;
+    w->background_height = w->height;
+    w->background_color = color;
+    w->background_dot_spacing = dot_spacing;
+    w->background_dot_color = dot_color;
+}
+
+// Like window_clear, but to the clear color with a dotted grid over it. The grid is only
+// rendered again when the window's size or the colors or spacing change
+void window_clear_background(Window *w, uint32_t color, int dot_spacing, uint32_t dot_color)
+{
+    if (w->background == NULL ||
+        w->background_width != w->width || w->background_height != w->height ||
+        w->background_color != color || w->background_dot_spacing != dot_spacing || w->background_dot_color != dot_color)
     {
-        w->z_buffer[i] = 1.0f;
+        build_background(w, color, dot_spacing, dot_color);
+    }
+
+    window_clear(w, color);
+    w->clear_to_background = true;
+}
+
+// One row of a tile's color, from the background layer or the clear color.
+// Most of the layer's rows have no dots, those are filled instead of copied
+static void fill_tile_color(Window *w, int x0, int y, int width)
+{
+    if (w->clear_to_background && w->background_rows[y])
+        memcpy(&w->color_buffer[(w->pitch * y) + x0], &w->background[(w->width * y) + x0], width * sizeof(uint32_t));
+    else
+        fill_pixels(&w->color_buffer[(w->pitch * y) + x0], w->clear_color, width);
+}
+
+void window_clear_tile(Window *w, int tile)
+{
+    int x0 = (tile % w->tiles_x) << WINDOW_TILE_WIDTH_SHIFT;
+    int y0 = (tile / w->tiles_x) << WINDOW_TILE_HEIGHT_SHIFT;
+    int width = w->width - x0 < WINDOW_TILE_WIDTH ? w->width - x0 : WINDOW_TILE_WIDTH;
+    int y1 = w->height - y0 < WINDOW_TILE_HEIGHT ? w->height : y0 + WINDOW_TILE_HEIGHT;
+
+    for (int y = y0; y < y1; y++)
+    {
+        fill_tile_color(w, x0, y, width);
+        fill_depths(&w->z_buffer[(w->width * y) + x0], 1.0f, width);
+    }
+    w->tile_cleared[tile] = 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Give the tiles nothing drew into this frame the clear color or background,
+// call it before the frame is shown. Neighboring untouched tiles are filled
+// as one run, row by row, so a mostly empty frame is filled about as fast as
+// a full clear.
+///////////////////////////////////////////////////////////////////////////////
+void window_fill_untouched_tiles(Window *w)
+{
+    for (int tile_y = 0; tile_y < w->tiles_y; tile_y++)
+    {
+        const uint8_t *cleared = &w->tile_cleared[tile_y * w->tiles_x];
+        int y0 = tile_y << WINDOW_TILE_HEIGHT_SHIFT;
+        int y1 = w->height - y0 < WINDOW_TILE_HEIGHT ? w->height : y0 + WINDOW_TILE_HEIGHT;
+
+        for (int y = y0; y < y1; y++)
+        {
+            for (int tile_x = 0; tile_x < w->tiles_x; tile_x++)
+            {
+                if (cleared[tile_x])
+                    continue;
+
+                int first = tile_x;
+                while (tile_x + 1 < w->tiles_x && !cleared[tile_x + 1])
+                    tile_x++;
+
+                int x0 = first << WINDOW_TILE_WIDTH_SHIFT;
+                int x1 = (tile_x + 1) << WINDOW_TILE_WIDTH_SHIFT;
+                if (x1 > w->width) x1 = w->width;
+                fill_tile_color(w, x0, y, x1 - x0);
+            }
+        }
     }
 }
 
@@ -425,8 +753,12 @@ void window_destroy(Window* w)
     if (!w) return;
     cleanup_rectangles();
     if (w->color_buffer_texture) { SDL_DestroyTexture(w->color_buffer_texture); w->color_buffer_texture = NULL; }
-    free(w->color_buffer); w->color_buffer = NULL;
+    if (w->headless) free(w->color_buffer);  // otherwise it's the texture's memory
+    w->color_buffer = NULL;
     free(w->z_buffer);     w->z_buffer     = NULL;
+    free(w->tile_cleared); w->tile_cleared = NULL;
+    free(w->background);   w->background   = NULL;
+    free(w->background_rows); w->background_rows = NULL;
     if (w->renderer)   { SDL_DestroyRenderer(w->renderer);   w->renderer   = NULL; }
     if (w->sdl_window) { SDL_DestroyWindow(w->sdl_window);   w->sdl_window = NULL; }
     SDL_Quit();
@@ -8,20 +8,52 @@
 // Forward-declare to avoid circular include
 struct AppState;
 
+// The frame is cleared lazily, one 128x8 tile of color and depth at a time (see display.c)
+#define WINDOW_TILE_WIDTH_SHIFT 7
+#define WINDOW_TILE_HEIGHT_SHIFT 3
+#define WINDOW_TILE_WIDTH (1 << WINDOW_TILE_WIDTH_SHIFT)
+#define WINDOW_TILE_HEIGHT (1 << WINDOW_TILE_HEIGHT_SHIFT)
+
 typedef struct {
     SDL_Window   *sdl_window;
     SDL_Renderer *renderer;
     SDL_Texture  *color_buffer_texture;
-    uint32_t     *color_buffer;
+    uint32_t     *color_buffer; // this frame's pixels, the locked texture when windowed, only valid between begin frame and present
+    int           pitch;        // pixels from the start of one color buffer row to the next, at least width
     float        *z_buffer;
 
-    // Internal render resolution (backbuffer/texture size)
+    // Internal render resolution, the top left width x height of the buffers is drawn and shown
     int           width;
     int           height;
 
+    // Size the buffers and texture are allocated for, width and height can be anything up to it
+    int           max_width;
+    int           max_height;
+
     // Physical window/display size (fullscreen target)
     int           screen_w;
     int           screen_h;
+
+    // One flag per tile, set once the tile's color and depth have been cleared this frame
+    uint8_t      *tile_cleared;
+    int           tiles_x;
+    int           tiles_y;
+    uint32_t      clear_color;
+
+    // Prerendered background (clear color and dotted grid) tiles are cleared to instead, see window_clear_background
+    uint32_t     *background;
+    uint8_t      *background_rows;    // 1 for the layer's rows with dots in them, the others are all clear color
+    int           background_width;   // size the layer was rendered at, it's rebuilt when the window's differs
+    int           background_height;
+    uint32_t      background_color;
+    int           background_dot_spacing;
+    uint32_t      background_dot_color;
+    bool          clear_to_background; // this frame's tiles are cleared from the layer, not to clear_color
+
+    // Headless windows have no SDL window or renderer, frames only live in the CPU buffers
+    bool          headless;
+    const char   *output_path;  // headless frames are written here (%d is the frame number), NULL to not write them
+    int           frame_index;  // frames presented so far
 } Window;
 
 // ABGR8888 (for SDL_PIXELFORMAT_RGBA32 on little-endian)
@@ -43,6 +75,17 @@ typedef struct {
 #define PINK       0xFFB469FF
 #define BROWN      0xFF214365
 
+void window_clear_tile(Window *w, int tile);
+
+// Clear the tile under (x, y) if nothing has touched it yet this frame.
+// Call it before reading or writing a pixel's color or depth
+static inline void window_touch_pixel(Window *w, int x, int y)
+{
+    int tile = ((y >> WINDOW_TILE_HEIGHT_SHIFT) * w->tiles_x) + (x >> WINDOW_TILE_WIDTH_SHIFT);
+    if (!w->tile_cleared[tile])
+        window_clear_tile(w, tile);
+}
+
 #define NUM_COLORS 17
 extern uint32_t colors[NUM_COLORS];
 extern uint32_t current_color;
@@ -61,7 +104,12 @@ enum Render_Method
 };
 
 bool window_init(Window* w, int req_w, int req_h);
+bool window_init_headless(Window* w, int req_w, int req_h, const char *output_path);
+bool window_begin_frame(Window *w);
 void render_color_buffer(Window *w);
+void window_present(Window *w);
+void window_present_again(Window *w);
+void window_set_render_size(Window *w, int width, int height);
 void draw_pixel(Window *w, int x, int y, uint32_t color);
 void draw_rectangle(Window *w, int x, int y, int width, int height, uint32_t color);
 void draw_grid(Window *w, int x, int y, int width, int height, int line_spacing, uint32_t color);
@@ -72,6 +120,9 @@ void draw_checker_board(Window *w, int cell_width, int cell_height, int rows, in
 void draw_line(Window *w, int x0, int y0, int x1, int y1, uint32_t color);
 void draw_filled_circle(Window *w, int cx, int cy, int rad, uint32_t color);
 void clear_color_buffer(Window *w, uint32_t color);
+void window_clear(Window *w, uint32_t color);
+void window_clear_background(Window *w, uint32_t color, int dot_spacing, uint32_t dot_color);
+void window_fill_untouched_tiles(Window *w);
 bool should_render_filled_triangles(struct AppState *app);
 bool should_render_textured_triangles(struct AppState *app);
 bool should_render_wireframe(struct AppState *app);
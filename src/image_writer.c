@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image_writer.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Image writer
+///////////////////////////////////////////////////////////////////////////////
+// Writes frames out of the color buffer for the headless backend. Nothing
+// here is meant to be small, a frame is written as fast as it can be, so the
+// PNGs are stored (uncompressed) deflate blocks. Any PNG reader opens them,
+// and they compress well afterwards if they need to be kept.
+///////////////////////////////////////////////////////////////////////////////
+
+// Deflate caps a stored block at 65535 bytes
+#define PNG_STORED_BLOCK_SIZE 65535
+
+static const uint8_t *pixel_row(const uint32_t *pixels, int pitch, int y)
+{
+    return (const uint8_t*)pixels + (size_t)pitch * y;
+}
+
+// Pack a row's RGBA32 pixels into RGB bytes
+static void row_to_rgb(const uint8_t *row, int width, uint8_t *rgb)
+{
+    for (int x = 0; x < width; x++)
+    {
+        rgb[3 * x + 0] = row[4 * x + 0];
+        rgb[3 * x + 1] = row[4 * x + 1];
+        rgb[3 * x + 2] = row[4 * x + 2];
+    }
+}
+
+bool write_ppm(const char *path, const uint32_t *pixels, int width, int height, int pitch)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+        return false;
+
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+
+    uint8_t *rgb = malloc((size_t)width * 3);
+    bool ok = true;
+    for (int y = 0; ok && y < height; y++)
+    {
+        row_to_rgb(pixel_row(pixels, pitch, y), width, rgb);
+        ok = fwrite(rgb, 3, width, file) == (size_t)width;
+    }
+    free(rgb);
+
+    return fclose(file) == 0 && ok;
+}
+
+bool write_raw(const char *path, const uint32_t *pixels, int width, int height, int pitch)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+        return false;
+
+    bool ok = true;
+    for (int y = 0; ok && y < height; y++)
+    {
+        ok = fwrite(pixel_row(pixels, pitch, y), sizeof(uint32_t), width, file) == (size_t)width;
+    }
+
+    return fclose(file) == 0 && ok;
+}
+
+static uint32_t crc_table[256];
+static bool crc_table_built = false;
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t length)
+{
+    if (!crc_table_built)
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            crc_table[n] = c;
+        }
+        crc_table_built = true;
+    }
+
+    for (size_t i = 0; i < length; i++)
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+static void put_u32_be(uint8_t *out, uint32_t value)
+{
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
+
+// Length, type, data and the CRC of the type and data
+static bool write_png_chunk(FILE *file, const char *type, const uint8_t *data, uint32_t length)
+{
+    uint8_t header[8];
+    put_u32_be(header, length);
+    memcpy(header + 4, type, 4);
+
+    uint32_t crc = crc32_update(0xFFFFFFFFu, header + 4, 4);
+    crc = crc32_update(crc, data, length) ^ 0xFFFFFFFFu;
+    uint8_t footer[4];
+    put_u32_be(footer, crc);
+
+    return fwrite(header, 1, 8, file) == 8 &&
+        (length == 0 || fwrite(data, 1, length, file) == length) &&
+        fwrite(footer, 1, 4, file) == 4;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 8-bit RGB PNG. Each scanline is a filter byte (0, none) and the row's
+// RGB bytes, the scanlines go into a zlib stream of stored deflate blocks.
+///////////////////////////////////////////////////////////////////////////////
+bool write_png(const char *path, const uint32_t *pixels, int width, int height, int pitch)
+{
+    size_t row_size = (size_t)width * 3 + 1;
+    size_t raw_size = row_size * height;
+
+    uint8_t *raw = malloc(raw_size);
+    for (int y = 0; y < height; y++)
+    {
+        raw[row_size * y] = 0;
+        row_to_rgb(pixel_row(pixels, pitch, y), width, &raw[row_size * y + 1]);
+    }
+
+    // zlib header, then every stored block's 5 byte header, then the Adler-32 checksum
+    size_t num_blocks = raw_size == 0 ? 1 : (raw_size + PNG_STORED_BLOCK_SIZE - 1) / PNG_STORED_BLOCK_SIZE;
+    size_t zlib_size = 2 + num_blocks * 5 + raw_size + 4;
+    uint8_t *zlib = malloc(zlib_size);
+    uint8_t *out = zlib;
+
+    *out++ = 0x78;  // deflate, 32k window
+    *out++ = 0x01;  // no preset dictionary, lowest level, header is a multiple of 31
+
+    uint32_t adler_a = 1;
+    uint32_t adler_b = 0;
+    size_t offset = 0;
+    for (size_t block = 0; block < num_blocks; block++)
+    {
+        size_t length = raw_size - offset < PNG_STORED_BLOCK_SIZE ? raw_size - offset : PNG_STORED_BLOCK_SIZE;
+        *out++ = block == num_blocks - 1 ? 1 : 0;  // BFINAL, BTYPE 00
+        *out++ = (uint8_t)length;
+        *out++ = (uint8_t)(length >> 8);
+        *out++ = (uint8_t)~length;
+        *out++ = (uint8_t)(~length >> 8);
+        memcpy(out, raw + offset, length);
+
+        for (size_t i = 0; i < length; i++)
+        {
+            adler_a = (adler_a + out[i]) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+
+        out += length;
+        offset += length;
+    }
+    put_u32_be(out, (adler_b << 16) | adler_a);
+    free(raw);
+
+    uint8_t ihdr[13];
+    put_u32_be(ihdr, width);
+    put_u32_be(ihdr + 4, height);
+    ihdr[8] = 8;    // bit depth
+    ihdr[9] = 2;    // RGB
+    ihdr[10] = 0;   // deflate
+    ihdr[11] = 0;   // adaptive filtering
+    ihdr[12] = 0;   // not interlaced
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        free(zlib);
+        return false;
+    }
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    bool ok = fwrite(signature, 1, 8, file) == 8 &&
+        write_png_chunk(file, "IHDR", ihdr, sizeof(ihdr)) &&
+        write_png_chunk(file, "IDAT", zlib, (uint32_t)zlib_size) &&
+        write_png_chunk(file, "IEND", NULL, 0);
+    free(zlib);
+
+    return fclose(file) == 0 && ok;
+}
+
+static bool has_extension(const char *path, const char *extension)
+{
+    size_t path_length = strlen(path);
+    size_t extension_length = strlen(extension);
+    if (path_length < extension_length)
+        return false;
+
+    // Case insensitive, .PNG is as much a PNG as .png
+    const char *end = path + path_length - extension_length;
+    for (size_t i = 0; i < extension_length; i++)
+    {
+        char c = end[i];
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        if (c != extension[i])
+            return false;
+    }
+    return true;
+}
+
+bool write_image(const char *path, const uint32_t *pixels, int width, int height, int pitch)
+{
+    if (has_extension(path, ".png"))
+        return write_png(path, pixels, width, height, pitch);
+    if (has_extension(path, ".raw"))
+        return write_raw(path, pixels, width, height, pitch);
+    return write_ppm(path, pixels, width, height, pitch);
+}
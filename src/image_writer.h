@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Pixels are 32-bit RGBA32 (R in the lowest byte) like the color buffer, rows are pitch bytes apart.
+// The format comes from the path's extension: .ppm, .png or .raw (the RGBA bytes as they are)
+bool write_image(const char *path, const uint32_t *pixels, int width, int height, int pitch);
+bool write_ppm(const char *path, const uint32_t *pixels, int width, int height, int pitch);
+bool write_png(const char *path, const uint32_t *pixels, int width, int height, int pitch);
+bool write_raw(const char *path, const uint32_t *pixels, int width, int height, int pitch);
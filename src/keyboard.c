@@ -7,6 +7,8 @@
 #include "light.h"
 #include "app.h"
 #include "mathdefs.h"
+#include "lod.h"
+#include "resolution.h"
 
 static const float MAX_FOVY = DEG2RAD(120);
 static const float MIN_FOVY = DEG2RAD(30);
@@ -15,6 +17,8 @@ static const float INC_FOVY = DEG2RAD(1);
 // Clamp pitch to just under +/-90°
 static const float MAX_PITCH = DEG2RAD(89.9f);
 static const float INC_CAMERA_SPEED = 0.25f;
+static const int LOD_TRIANGLE_BUDGET_STEP = 1000;
+static const float LOD_PIXEL_BUDGET_STEP = 0.25f;
 
 static bool k_w, k_a, k_s, k_d, k_space, k_lshift;
 static bool k_left, k_right, k_up, k_down;
@@ -29,6 +33,13 @@ void process_input(AppState *app)
 			app->is_running = false;
 			break;
 		}
+		if (event.type == SDL_WINDOWEVENT)
+		{
+			// What was on the window may be gone, a paused frame isn't drawn again to cover it
+			if (event.window.event == SDL_WINDOWEVENT_EXPOSED || event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+				app->needs_present = true;
+			continue;
+		}
 		if (event.type == SDL_KEYDOWN)
 		{
 			SDL_Keycode k = event.key.keysym.sym;
@@ -150,6 +161,57 @@ void process_input(AppState *app)
 			case SDLK_l:
 				app->lighting = !(app->lighting);
 				break;
+
+			// Enable or disable static batching
+			case SDLK_b:
+				app->static_batching = !(app->static_batching);
+				break;
+
+			// Enable or disable mipmapping
+			case SDLK_t:
+				app->mipmapping = !(app->mipmapping);
+				break;
+
+			// Switch between nearest and bilinear texture filtering
+			case SDLK_f:
+				app->texture_filter = (app->texture_filter == TEXTURE_NEAREST) ? TEXTURE_BILINEAR : TEXTURE_NEAREST;
+				break;
+
+			// Compress every texture to BC1 blocks, or back to the default layout
+			case SDLK_x:
+				app->compressed_textures = !(app->compressed_textures);
+				for (int i = 0; i < get_num_meshes(); i++)
+				{
+					if (get_mesh(i)->texture)
+						texture_set_layout(get_mesh(i)->texture, app->compressed_textures ? TEXTURE_BC1 : TEXTURE_DEFAULT_LAYOUT);
+				}
+				break;
+
+			// Enable or disable the LOD budget controller
+			case SDLK_k:
+				lod_controller.enabled = !(lod_controller.enabled);
+				break;
+			// Lower or raise the LOD controller's triangle budget
+			case SDLK_COMMA:
+				if (lod_controller.triangle_budget > LOD_TRIANGLE_BUDGET_STEP)
+					lod_controller.triangle_budget -= LOD_TRIANGLE_BUDGET_STEP;
+				break;
+			case SDLK_PERIOD:
+				lod_controller.triangle_budget += LOD_TRIANGLE_BUDGET_STEP;
+				break;
+			// Lower or raise the LOD controller's pixel budget
+			case SDLK_SEMICOLON:
+				if (lod_controller.pixel_budget > LOD_PIXEL_BUDGET_STEP)
+					lod_controller.pixel_budget -= LOD_PIXEL_BUDGET_STEP;
+				break;
+			case SDLK_QUOTE:
+				lod_controller.pixel_budget += LOD_PIXEL_BUDGET_STEP;
+				break;
+
+			// Enable or disable dynamic resolution
+			case SDLK_v:
+				resolution_controller.enabled = !(resolution_controller.enabled);
+				break;
 			}
 		}
 
@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "loader.h"
+#include "mesh.h"
+#include "array.h"
+#include "texture.h"
+#include "texture_registry.h"
+#include "texture_residency.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Parallel asset loading
+///////////////////////////////////////////////////////////////////////////////
+// Parsing an OBJ (and simplifying its levels of detail) and decoding a PNG
+// don't depend on each other, so every mesh and every texture of a scene is
+// its own work item. A pool of threads pulls items off a shared counter until
+// they run out. Meshes that use the same PNG file share one decode, and a PNG
+// the texture registry already holds isn't decoded at all.
+// Workers only write their own result slot, nothing reaches the mesh table or
+// the texture registry until every item is done, so the rest of the program
+// never sees a half-loaded scene.
+//
+// Define LOADER_CHECK_UNHASHED to load as if no PNG could be hashed, and flag
+// any mesh whose UVs or texture publishing changed anyway.
+///////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+    const mesh_job_t *jobs;
+    int num_jobs;
+    const char **texture_paths;  // PNG path of each unique file, as the first job gave it
+    char **canonical_paths;      // canonical path of each unique file
+    int num_textures;
+    int *job_textures;           // index into texture_paths for every job
+    mesh_t *meshes;              // one result per job
+    texture_t **textures;        // one result per unique file, already set if the registry had it
+    bool *registered;            // the texture came from the registry
+    texture_region_t *regions;   // where each file's texels are in its texture, a rectangle of an atlas page if it was packed
+    uint64_t *hashes;            // contents of each decoded file, for the registry
+    uint64_t *sizes;
+    bool *hashed;
+    SDL_atomic_t next_item;      // textures first, since they take the longest, then meshes
+} loader_t;
+
+static int loader_worker(void *data)
+{
+    loader_t *loader = data;
+    int num_items = loader->num_textures + loader->num_jobs;
+
+    for (;;)
+    {
+        int item = SDL_AtomicAdd(&loader->next_item, 1);
+        if (item >= num_items)
+            break;
+
+        if (item < loader->num_textures)
+        {
+            if (!loader->registered[item])
+            {
+                loader->hashed[item] = texture_hash_file(loader->canonical_paths[item], &loader->hashes[item], &loader->sizes[item]);
+#ifdef LOADER_CHECK_UNHASHED
+                loader->hashed[item] = false;
+#endif
+                loader->textures[item] = texture_residency_load(loader->texture_paths[item]);
+            }
+        }
+        else
+        {
+            const mesh_job_t *job = &loader->jobs[item - loader->num_textures];
+            init_mesh(&loader->meshes[item - loader->num_textures], job->obj_file, job->scale, job->translation, job->rotation, job->generate_lods);
+        }
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Load every job's mesh and texture on a thread pool, then add the meshes to
+// the mesh table in job order, the same as calling load_mesh for each job
+///////////////////////////////////////////////////////////////////////////////
+void load_meshes(const mesh_job_t *jobs, int num_jobs)
+{
+    if (num_jobs <= 0)
+        return;
+
+    loader_t loader = {
+        .jobs = jobs,
+        .num_jobs = num_jobs,
+        .texture_paths = malloc(num_jobs * sizeof(char*)),
+        .canonical_paths = malloc(num_jobs * sizeof(char*)),
+        .num_textures = 0,
+        .job_textures = malloc(num_jobs * sizeof(int)),
+        .meshes = malloc(num_jobs * sizeof(mesh_t)),
+        .textures = calloc(num_jobs, sizeof(texture_t*)),
+        .registered = calloc(num_jobs, sizeof(bool)),
+        .regions = calloc(num_jobs, sizeof(texture_region_t)),
+        .hashes = calloc(num_jobs, sizeof(uint64_t)),
+        .sizes = calloc(num_jobs, sizeof(uint64_t)),
+        .hashed = calloc(num_jobs, sizeof(bool))
+    };
+    SDL_AtomicSet(&loader.next_item, 0);
+
+    // Decode each PNG file once, however many meshes use it and whatever path they use
+    for (int i = 0; i < num_jobs; i++)
+    {
+        char *canonical_path = texture_canonical_path(jobs[i].png_file);
+
+        int texture_index = 0;
+        while (texture_index < loader.num_textures && strcmp(loader.canonical_paths[texture_index], canonical_path) != 0)
+        {
+            texture_index++;
+        }
+        if (texture_index == loader.num_textures)
+        {
+            loader.texture_paths[loader.num_textures] = jobs[i].png_file;
+            loader.canonical_paths[loader.num_textures] = canonical_path;
+
+            // Already loaded by an earlier scene, the loader takes a reference like any other user
+            loader.textures[loader.num_textures] = texture_registry_find_path(canonical_path, &loader.regions[loader.num_textures]);
+            loader.registered[loader.num_textures] = loader.textures[loader.num_textures] != NULL;
+            loader.num_textures++;
+        }
+        else
+        {
+            free(canonical_path);
+        }
+        loader.job_textures[i] = texture_index;
+    }
+
+    // The calling thread works too, so only spawn the rest
+    int num_items = loader.num_textures + num_jobs;
+    int num_threads = SDL_GetCPUCount();
+    if (num_threads > num_items) num_threads = num_items;
+    if (num_threads < 1) num_threads = 1;
+
+    SDL_Thread **threads = malloc(num_threads * sizeof(SDL_Thread*));
+    for (int i = 1; i < num_threads; i++)
+    {
+        threads[i] = SDL_CreateThread(loader_worker, "loader", &loader);
+    }
+    loader_worker(&loader);
+    for (int i = 1; i < num_threads; i++)
+    {
+        // A thread that couldn't be created just leaves more items to the others
+        SDL_WaitThread(threads[i], NULL);
+    }
+    free(threads);
+
+    // Register the new textures. Two different files can still hold the same
+    // image, the later ones are dropped for the one that's already registered
+    for (int i = 0; i < loader.num_textures; i++)
+    {
+        if (loader.registered[i] || loader.textures[i] == NULL)
+            continue;
+
+        // A texture the loader decoded is all one image, even one that couldn't be hashed
+        // (the file went away after decoding) and so can't be registered
+        loader.regions[i] = (texture_region_t){0, 0, loader.textures[i]->mips[0].width, loader.textures[i]->mips[0].height};
+        if (!loader.hashed[i])
+            continue;
+
+        texture_t *existing = texture_registry_find_content(loader.canonical_paths[i], loader.hashes[i], loader.sizes[i], &loader.regions[i]);
+        if (existing)
+        {
+            free_texture(loader.textures[i]);
+            loader.textures[i] = existing;
+        }
+        else
+        {
+            texture_registry_add(loader.canonical_paths[i], loader.hashes[i], loader.sizes[i], loader.textures[i]);
+        }
+    }
+
+    // Everything is loaded, publish it
+    for (int i = 0; i < num_jobs; i++)
+    {
+        mesh_t *mesh = &loader.meshes[i];
+
+        texture_t *texture = loader.textures[loader.job_textures[i]];
+        if (texture)
+        {
+#ifdef LOADER_CHECK_UNHASHED
+            // Nothing was registered, so every texture is the mesh's own and its UVs must come through untouched
+            int num_faces = array_length(mesh->faces);
+            face_t *expected = malloc(num_faces * sizeof(face_t));
+            memcpy(expected, mesh->faces, num_faces * sizeof(face_t));
+#endif
+            texture->ref_count++;
+            mesh_set_texture(mesh, texture, &loader.regions[loader.job_textures[i]], jobs[i].png_file);
+#ifdef LOADER_CHECK_UNHASHED
+            if (mesh->texture != texture || memcmp(expected, mesh->faces, num_faces * sizeof(face_t)) != 0)
+                fprintf(stderr, "loader: the UVs or texture of %s changed although %s couldn't be hashed\n", jobs[i].obj_file, jobs[i].png_file);
+            free(expected);
+#endif
+        }
+
+        if (!add_mesh(mesh))
+        {
+            fprintf(stderr, "Too many meshes, %s was not loaded\n", jobs[i].obj_file);
+            free_mesh(mesh);
+        }
+    }
+
+    // Let go of the loader's own reference, the meshes hold the rest
+    for (int i = 0; i < loader.num_textures; i++)
+    {
+        free_texture(loader.textures[i]);
+        free(loader.canonical_paths[i]);
+    }
+
+    free(loader.texture_paths);
+    free(loader.canonical_paths);
+    free(loader.registered);
+    free(loader.regions);
+    free(loader.hashes);
+    free(loader.sizes);
+    free(loader.hashed);
+    free(loader.job_textures);
+    free(loader.meshes);
+    free(loader.textures);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+#include "vector.h"
+
+// Everything load_mesh takes, so a whole scene can be described up front and loaded at once
+typedef struct
+{
+    char *obj_file;
+    char *png_file;
+    vec3_t scale;
+    vec3_t translation;
+    vec3_t rotation;
+    bool generate_lods;
+} mesh_job_t;
+
+void load_meshes(const mesh_job_t *jobs, int num_jobs);
@@ -0,0 +1,704 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "lod.h"
+#include "array.h"
+#include "mathdefs.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Level of detail generation with quadric error metric simplification
+///////////////////////////////////////////////////////////////////////////////
+// Every vertex stores a quadric Q: the sum of the squared distances to the
+// planes of the faces around it. Collapsing the edge u->v moves u onto v and
+// costs v^T (Qu + Qv) v, so the cheapest edges are the ones whose removal
+// barely changes the surface. We collapse the cheapest edges in passes until
+// the face count reaches the target.
+//
+// Vertices on a UV seam (the same position used with different UVs) may only
+// slide along the seam, and open boundaries and sharp creases are held in
+// place by extra planes, so the texture mapping and silhouette survive.
+///////////////////////////////////////////////////////////////////////////////
+
+// Symmetric 4x4 error quadric, only the upper triangle is stored
+typedef struct
+{
+    double aa, ab, ac, ad, bb, bc, bd, cc, cd, dd;
+} quadric_t;
+
+// A candidate half-edge collapse that moves vertex u onto vertex v
+typedef struct
+{
+    double cost;
+    int u;
+    int v;
+} collapse_t;
+
+#define VERTEX_BOUNDARY 1
+
+// Faces whose normal turns more than this (cosine) after a collapse are rejected
+#define LOD_MAX_NORMAL_FLIP 0.2f
+#define LOD_MAX_PASSES 64
+
+// How much harder it is to move a boundary or crease edge than the surface itself
+#define LOD_EDGE_WEIGHT 100.0
+
+// Edges whose faces meet at more than 60 degrees (cosine) are treated as creases
+#define LOD_CREASE_COS 0.5f
+
+typedef struct
+{
+    vec3_t *vertices;
+    face_t *faces;
+    int num_vertices;
+    int num_faces;
+    int num_live_faces;
+    bool *face_dead;
+    quadric_t *quadrics;
+    unsigned char *flags;
+    bool *touched;
+    int *adjacency_start; // faces around vertex i are adjacency[adjacency_start[i]..adjacency_start[i + 1]]
+    int *adjacency;
+    int *scratch;         // room for the neighbors of two vertices
+    tex2_t *pending_uvs;  // new UVs for the faces around the vertex being collapsed
+    int scratch_size;
+} simplifier_t;
+
+static int face_vertex(const face_t *face, int corner)
+{
+    if (corner == 0) return face->a - 1;
+    if (corner == 1) return face->b - 1;
+    return face->c - 1;
+}
+
+static tex2_t face_uv(const face_t *face, int corner)
+{
+    if (corner == 0) return face->a_uv;
+    if (corner == 1) return face->b_uv;
+    return face->c_uv;
+}
+
+static void face_set_corner(face_t *face, int corner, int vertex, tex2_t uv)
+{
+    if (corner == 0) { face->a = vertex + 1; face->a_uv = uv; }
+    else if (corner == 1) { face->b = vertex + 1; face->b_uv = uv; }
+    else { face->c = vertex + 1; face->c_uv = uv; }
+}
+
+static int face_find_corner(const face_t *face, int vertex)
+{
+    for (int corner = 0; corner < 3; corner++)
+    {
+        if (face_vertex(face, corner) == vertex) return corner;
+    }
+    return -1;
+}
+
+static void quadric_add(quadric_t *q, const quadric_t *r)
+{
+    q->aa += r->aa; q->ab += r->ab; q->ac += r->ac; q->ad += r->ad;
+    q->bb += r->bb; q->bc += r->bc; q->bd += r->bd;
+    q->cc += r->cc; q->cd += r->cd;
+    q->dd += r->dd;
+}
+
+static double quadric_error(const quadric_t *q, vec3_t p)
+{
+    double x = p.x, y = p.y, z = p.z;
+    return q->aa * x * x + 2 * q->ab * x * y + 2 * q->ac * x * z + 2 * q->ad * x
+         + q->bb * y * y + 2 * q->bc * y * z + 2 * q->bd * y
+         + q->cc * z * z + 2 * q->cd * z
+         + q->dd;
+}
+
+static vec3_t face_normal_with(const simplifier_t *s, const face_t *face, int moved, vec3_t moved_position)
+{
+    vec3_t p[3];
+    for (int corner = 0; corner < 3; corner++)
+    {
+        int vertex = face_vertex(face, corner);
+        p[corner] = (vertex == moved) ? moved_position : s->vertices[vertex];
+    }
+    return vec3_cross(vec3_sub(p[1], p[0]), vec3_sub(p[2], p[0]));
+}
+
+static void compute_quadrics(simplifier_t *s)
+{
+    for (int i = 0; i < s->num_faces; i++)
+    {
+        vec3_t normal = face_normal_with(s, &s->faces[i], -1, (vec3_t){0, 0, 0});
+        float length = vec3_length(normal);
+        if (length <= 0.0f) continue;
+
+        // Weight each plane by the face area so big faces hold their shape
+        double weight = length * 0.5;
+        double a = normal.x / length;
+        double b = normal.y / length;
+        double c = normal.z / length;
+        double d = -(a * s->vertices[s->faces[i].a - 1].x + b * s->vertices[s->faces[i].a - 1].y + c * s->vertices[s->faces[i].a - 1].z);
+
+        quadric_t plane = {
+            a * a * weight, a * b * weight, a * c * weight, a * d * weight,
+            b * b * weight, b * c * weight, b * d * weight,
+            c * c * weight, c * d * weight,
+            d * d * weight
+        };
+
+        for (int corner = 0; corner < 3; corner++)
+        {
+            quadric_add(&s->quadrics[face_vertex(&s->faces[i], corner)], &plane);
+        }
+    }
+}
+
+// Rebuild the vertex -> live faces table, it goes stale after every pass
+static void build_adjacency(simplifier_t *s)
+{
+    memset(s->adjacency_start, 0, sizeof(int) * (s->num_vertices + 1));
+
+    for (int i = 0; i < s->num_faces; i++)
+    {
+        if (s->face_dead[i]) continue;
+        for (int corner = 0; corner < 3; corner++)
+        {
+            s->adjacency_start[face_vertex(&s->faces[i], corner) + 1]++;
+        }
+    }
+
+    int max_degree = 0;
+    for (int v = 0; v < s->num_vertices; v++)
+    {
+        int degree = s->adjacency_start[v + 1];
+        if (degree > max_degree) max_degree = degree;
+        s->adjacency_start[v + 1] += s->adjacency_start[v];
+    }
+
+    // Fill using the start table as a cursor, then shift it back into place
+    for (int i = 0; i < s->num_faces; i++)
+    {
+        if (s->face_dead[i]) continue;
+        for (int corner = 0; corner < 3; corner++)
+        {
+            int v = face_vertex(&s->faces[i], corner);
+            s->adjacency[s->adjacency_start[v]++] = i;
+        }
+    }
+    for (int v = s->num_vertices; v > 0; v--)
+    {
+        s->adjacency_start[v] = s->adjacency_start[v - 1];
+    }
+    s->adjacency_start[0] = 0;
+
+    if (max_degree * 4 > s->scratch_size)
+    {
+        s->scratch_size = max_degree * 4;
+        s->scratch = (int*)realloc(s->scratch, sizeof(int) * s->scratch_size);
+        s->pending_uvs = (tex2_t*)realloc(s->pending_uvs, sizeof(tex2_t) * s->scratch_size);
+    }
+}
+
+// Write the neighbors of a vertex (with duplicates, two per face) and return how many there are
+static int collect_neighbors(const simplifier_t *s, int v, int *out)
+{
+    int count = 0;
+    for (int k = s->adjacency_start[v]; k < s->adjacency_start[v + 1]; k++)
+    {
+        const face_t *face = &s->faces[s->adjacency[k]];
+        for (int corner = 0; corner < 3; corner++)
+        {
+            int n = face_vertex(face, corner);
+            if (n != v) out[count++] = n;
+        }
+    }
+    return count;
+}
+
+static int count_occurrences(const int *list, int count, int value)
+{
+    int occurrences = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (list[i] == value) occurrences++;
+    }
+    return occurrences;
+}
+
+static bool uv_equal(tex2_t a, tex2_t b)
+{
+    return fabsf(a.u - b.u) <= 1e-5f && fabsf(a.v - b.v) <= 1e-5f;
+}
+
+static void classify_vertices(simplifier_t *s)
+{
+    for (int v = 0; v < s->num_vertices; v++)
+    {
+        s->flags[v] = 0;
+
+        // An edge used by a single face lies on the open boundary of the mesh
+        int count = collect_neighbors(s, v, s->scratch);
+        for (int i = 0; i < count; i++)
+        {
+            if (count_occurrences(s->scratch, count, s->scratch[i]) == 1)
+            {
+                s->flags[v] |= VERTEX_BOUNDARY;
+                break;
+            }
+        }
+    }
+}
+
+// Count the live faces that use both u and v
+static int count_shared_faces(const simplifier_t *s, int u, int v)
+{
+    int shared = 0;
+    for (int k = s->adjacency_start[u]; k < s->adjacency_start[u + 1]; k++)
+    {
+        if (face_find_corner(&s->faces[s->adjacency[k]], v) >= 0) shared++;
+    }
+    return shared;
+}
+
+// Return the normal of the other live face on the edge a-b, or false if the edge is open
+static bool find_opposite_normal(const simplifier_t *s, int face_index, int a, int b, vec3_t *normal)
+{
+    for (int k = s->adjacency_start[a]; k < s->adjacency_start[a + 1]; k++)
+    {
+        int f = s->adjacency[k];
+        if (f == face_index || face_find_corner(&s->faces[f], b) < 0) continue;
+
+        *normal = face_normal_with(s, &s->faces[f], -1, (vec3_t){0, 0, 0});
+        vec3_normalize(normal);
+        return true;
+    }
+    return false;
+}
+
+// Open boundaries and sharp creases (like the thin edge of a wing) have nothing in the
+// plain quadrics stopping them from sliding inwards, so we add a steep plane through
+// every such edge, perpendicular to its face, to hold the outline in place
+static void add_edge_quadrics(simplifier_t *s)
+{
+    for (int i = 0; i < s->num_faces; i++)
+    {
+        const face_t *face = &s->faces[i];
+        vec3_t normal = face_normal_with(s, face, -1, (vec3_t){0, 0, 0});
+        if (vec3_length(normal) <= 0.0f) continue;
+        vec3_normalize(&normal);
+
+        for (int corner = 0; corner < 3; corner++)
+        {
+            int a = face_vertex(face, corner);
+            int b = face_vertex(face, (corner + 1) % 3);
+
+            vec3_t opposite_normal;
+            if (find_opposite_normal(s, i, a, b, &opposite_normal) &&
+                vec3_dot(normal, opposite_normal) > LOD_CREASE_COS)
+            {
+                continue;
+            }
+
+            vec3_t edge = vec3_sub(s->vertices[b], s->vertices[a]);
+            vec3_t side = vec3_cross(edge, normal);
+            float length = vec3_length(side);
+            if (length <= 0.0f) continue;
+
+            double weight = vec3_dot(edge, edge) * LOD_EDGE_WEIGHT;
+            double pa = side.x / length;
+            double pb = side.y / length;
+            double pc = side.z / length;
+            double pd = -(pa * s->vertices[a].x + pb * s->vertices[a].y + pc * s->vertices[a].z);
+
+            quadric_t plane = {
+                pa * pa * weight, pa * pb * weight, pa * pc * weight, pa * pd * weight,
+                pb * pb * weight, pb * pc * weight, pb * pd * weight,
+                pc * pc * weight, pc * pd * weight,
+                pd * pd * weight
+            };
+            quadric_add(&s->quadrics[a], &plane);
+            quadric_add(&s->quadrics[b], &plane);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The faces around u form one or more UV "wedges", one per distinct UV that u
+// has (an interior vertex has one, a vertex on a seam has one per side). When u
+// moves onto v every face keeps its wedge, so it needs the UV that v has in
+// that same wedge, which we read from a face of the wedge that already uses v.
+// If a wedge doesn't touch v the collapse would smear the texture across the
+// seam, so it isn't allowed.
+///////////////////////////////////////////////////////////////////////////////
+static bool find_wedge_uv(const simplifier_t *s, int u, int v, tex2_t u_uv, tex2_t *v_uv)
+{
+    for (int k = s->adjacency_start[u]; k < s->adjacency_start[u + 1]; k++)
+    {
+        const face_t *face = &s->faces[s->adjacency[k]];
+        int corner = face_find_corner(face, v);
+        if (corner < 0) continue;
+
+        if (uv_equal(face_uv(face, face_find_corner(face, u)), u_uv))
+        {
+            *v_uv = face_uv(face, corner);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Collapsing u->v must keep the surface manifold, the outline, the UV seams, and must not fold any face over
+static bool can_collapse(simplifier_t *s, int u, int v)
+{
+    int shared_faces = count_shared_faces(s, u, v);
+    if (shared_faces == 0) return false;
+
+    // A boundary vertex may only slide along the boundary
+    if ((s->flags[u] & VERTEX_BOUNDARY) && shared_faces != 1) return false;
+
+    for (int k = s->adjacency_start[u]; k < s->adjacency_start[u + 1]; k++)
+    {
+        const face_t *face = &s->faces[s->adjacency[k]];
+        if (face_find_corner(face, v) >= 0) continue;
+
+        tex2_t v_uv;
+        if (!find_wedge_uv(s, u, v, face_uv(face, face_find_corner(face, u)), &v_uv)) return false;
+
+        vec3_t before = face_normal_with(s, face, -1, (vec3_t){0, 0, 0});
+        vec3_t after = face_normal_with(s, face, u, s->vertices[v]);
+        float before_length = vec3_length(before);
+        float after_length = vec3_length(after);
+        if (after_length <= 0.0f || before_length <= 0.0f) return false;
+        if (vec3_dot(before, after) < LOD_MAX_NORMAL_FLIP * before_length * after_length) return false;
+    }
+
+    // Link condition: u and v may only share the vertices opposite their shared faces
+    int *neighbors_u = s->scratch;
+    int count_u = collect_neighbors(s, u, neighbors_u);
+    int *neighbors_v = s->scratch + count_u;
+    int count_v = collect_neighbors(s, v, neighbors_v);
+
+    int common = 0;
+    for (int i = 0; i < count_u; i++)
+    {
+        int n = neighbors_u[i];
+        if (n == v || count_occurrences(neighbors_u, i, n) > 0) continue;
+        if (count_occurrences(neighbors_v, count_v, n) > 0) common++;
+    }
+    return common <= shared_faces;
+}
+
+static void collapse(simplifier_t *s, int u, int v)
+{
+    // Work out every face's new UV before any of them change
+    for (int k = s->adjacency_start[u]; k < s->adjacency_start[u + 1]; k++)
+    {
+        face_t *face = &s->faces[s->adjacency[k]];
+        if (face_find_corner(face, v) >= 0) continue;
+
+        tex2_t v_uv = {0, 0};
+        find_wedge_uv(s, u, v, face_uv(face, face_find_corner(face, u)), &v_uv);
+        s->pending_uvs[k - s->adjacency_start[u]] = v_uv;
+    }
+
+    for (int k = s->adjacency_start[u]; k < s->adjacency_start[u + 1]; k++)
+    {
+        int f = s->adjacency[k];
+        face_t *face = &s->faces[f];
+
+        for (int corner = 0; corner < 3; corner++)
+        {
+            s->touched[face_vertex(face, corner)] = true;
+        }
+
+        if (face_find_corner(face, v) >= 0)
+        {
+            s->face_dead[f] = true;
+            s->num_live_faces--;
+        }
+        else
+        {
+            face_set_corner(face, face_find_corner(face, u), v, s->pending_uvs[k - s->adjacency_start[u]]);
+        }
+    }
+
+    quadric_add(&s->quadrics[v], &s->quadrics[u]);
+}
+
+static int compare_collapse(const void *a, const void *b)
+{
+    double cost_a = ((const collapse_t*)a)->cost;
+    double cost_b = ((const collapse_t*)b)->cost;
+    return (cost_a > cost_b) - (cost_a < cost_b);
+}
+
+void lod_simplify(vec3_t *vertices, face_t *faces, int target_faces, vec3_t **out_vertices, face_t **out_faces)
+{
+    simplifier_t s = {0};
+    s.num_vertices = array_length(vertices);
+    s.num_faces = array_length(faces);
+    s.num_live_faces = s.num_faces;
+    s.vertices = vertices;
+    s.faces = (face_t*)malloc(sizeof(face_t) * s.num_faces);
+    memcpy(s.faces, faces, sizeof(face_t) * s.num_faces);
+    s.face_dead = (bool*)calloc(s.num_faces, sizeof(bool));
+    s.quadrics = (quadric_t*)calloc(s.num_vertices, sizeof(quadric_t));
+    s.flags = (unsigned char*)calloc(s.num_vertices, 1);
+    s.touched = (bool*)calloc(s.num_vertices, sizeof(bool));
+    s.adjacency_start = (int*)calloc(s.num_vertices + 1, sizeof(int));
+    s.adjacency = (int*)malloc(sizeof(int) * s.num_faces * 3);
+    collapse_t *candidates = (collapse_t*)malloc(sizeof(collapse_t) * s.num_faces * 6);
+
+    compute_quadrics(&s);
+    build_adjacency(&s);
+    add_edge_quadrics(&s);
+
+    for (int pass = 0; pass < LOD_MAX_PASSES && s.num_live_faces > target_faces; pass++)
+    {
+        build_adjacency(&s);
+        classify_vertices(&s);
+        memset(s.touched, 0, sizeof(bool) * (size_t)s.num_vertices);
+
+        // Every directed edge of every live face is a candidate
+        int num_candidates = 0;
+        for (int i = 0; i < s.num_faces; i++)
+        {
+            if (s.face_dead[i]) continue;
+            for (int from = 0; from < 3; from++)
+            {
+                int u = face_vertex(&s.faces[i], from);
+
+                for (int to = 0; to < 3; to++)
+                {
+                    if (to == from) continue;
+                    int v = face_vertex(&s.faces[i], to);
+
+                    quadric_t q = s.quadrics[u];
+                    quadric_add(&q, &s.quadrics[v]);
+                    candidates[num_candidates++] = (collapse_t){quadric_error(&q, s.vertices[v]), u, v};
+                }
+            }
+        }
+        qsort(candidates, num_candidates, sizeof(collapse_t), compare_collapse);
+
+        // Collapse the cheapest edges, each vertex is only touched once per pass
+        // so the adjacency table stays valid for the ones we haven't touched yet
+        int num_collapsed = 0;
+        for (int i = 0; i < num_candidates && s.num_live_faces > target_faces; i++)
+        {
+            int u = candidates[i].u;
+            int v = candidates[i].v;
+            if (s.touched[u] || s.touched[v]) continue;
+            if (!can_collapse(&s, u, v)) continue;
+
+            collapse(&s, u, v);
+            num_collapsed++;
+        }
+
+        if (num_collapsed == 0) break;
+    }
+
+    // Copy out the live faces and only the vertices they still use
+    int *remap = (int*)malloc(sizeof(int) * s.num_vertices);
+    for (int v = 0; v < s.num_vertices; v++) remap[v] = -1;
+
+    int num_out_vertices = 0;
+    for (int i = 0; i < s.num_faces; i++)
+    {
+        if (s.face_dead[i]) continue;
+
+        face_t face = s.faces[i];
+        for (int corner = 0; corner < 3; corner++)
+        {
+            int v = face_vertex(&face, corner);
+            if (remap[v] < 0)
+            {
+                remap[v] = num_out_vertices++;
+                array_push(*out_vertices, vertices[v]);
+            }
+            face_set_corner(&face, corner, remap[v], face_uv(&face, corner));
+        }
+        array_push(*out_faces, face);
+    }
+
+    free(remap);
+    free(candidates);
+    free(s.faces);
+    free(s.face_dead);
+    free(s.quadrics);
+    free(s.flags);
+    free(s.touched);
+    free(s.adjacency_start);
+    free(s.adjacency);
+    free(s.scratch);
+    free(s.pending_uvs);
+}
+
+void lod_compute_bounds(mesh_t *mesh)
+{
+    int num_vertices = array_length(mesh->vertices);
+    if (num_vertices == 0)
+    {
+        mesh->bounds_center = (vec3_t){0, 0, 0};
+        mesh->bounds_radius = 0.0f;
+        return;
+    }
+
+    vec3_t min = mesh->vertices[0];
+    vec3_t max = mesh->vertices[0];
+    for (int i = 1; i < num_vertices; i++)
+    {
+        vec3_t v = mesh->vertices[i];
+        if (v.x < min.x) min.x = v.x;
+        if (v.y < min.y) min.y = v.y;
+        if (v.z < min.z) min.z = v.z;
+        if (v.x > max.x) max.x = v.x;
+        if (v.y > max.y) max.y = v.y;
+        if (v.z > max.z) max.z = v.z;
+    }
+
+    mesh->bounds_center = vec3_mul(vec3_add(min, max), 0.5f);
+    mesh->bounds_radius = 0.0f;
+    for (int i = 0; i < num_vertices; i++)
+    {
+        float distance = vec3_length(vec3_sub(mesh->vertices[i], mesh->bounds_center));
+        if (distance > mesh->bounds_radius) mesh->bounds_radius = distance;
+    }
+}
+
+void lod_generate(mesh_t *mesh)
+{
+    for (int level = 1; level < MAX_NUM_LODS; level++)
+    {
+        mesh_lod_t *previous = &mesh->lods[level - 1];
+        int previous_faces = array_length(previous->faces);
+        int target_faces = (int)(previous_faces * LOD_REDUCTION_RATIO);
+        if (target_faces < LOD_MIN_FACES) break;
+
+        mesh_lod_t lod = {NULL, NULL};
+        lod_simplify(previous->vertices, previous->faces, target_faces, &lod.vertices, &lod.faces);
+
+        // Stop when seams and boundaries leave almost nothing left to collapse
+        if (array_length(lod.faces) > previous_faces * 0.9f)
+        {
+            array_free(lod.vertices);
+            array_free(lod.faces);
+            break;
+        }
+
+        mesh->lods[level] = lod;
+        mesh->num_lods = level + 1;
+    }
+}
+
+// Return the diameter in pixels that the mesh's bounding sphere covers on the screen,
+// using the mesh's cached matrices
+float lod_projected_size(mesh_t *mesh, float fovy, int screen_height)
+{
+    // The clip space w of the center is its depth in front of the camera
+    vec4_t center = mat4_mul_vec4(mesh->mvp_matrix, vec4_from_vec3(mesh->bounds_center));
+
+    float radius = mesh_view_radius(mesh);
+
+    // The camera is inside (or right next to) the sphere
+    if (center.w <= radius) return FLT_MAX;
+
+    return (radius * screen_height) / (center.w * tanf(fovy / 2));
+}
+
+// The bias shifts every threshold, a bias of 1 drops a level at twice the on-screen size
+int lod_select_level(mesh_t *mesh, float projected_size, float bias)
+{
+    if (mesh->num_lods <= 1) return 0;
+    if (projected_size <= 0.0f) return mesh->num_lods - 1;
+
+    int level = (int)floorf(log2f(LOD_FULL_DETAIL_PIXELS / projected_size) + bias);
+    if (level < 0) level = 0;
+    if (level > mesh->num_lods - 1) level = mesh->num_lods - 1;
+    return level;
+}
+
+// Free the generated levels, level 0 belongs to the mesh itself
+void lod_free(mesh_t *mesh)
+{
+    for (int level = 1; level < mesh->num_lods; level++)
+    {
+        array_free(mesh->lods[level].vertices);
+        array_free(mesh->lods[level].faces);
+        mesh->lods[level].vertices = NULL;
+        mesh->lods[level].faces = NULL;
+    }
+    mesh->num_lods = 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// LOD budget controller
+///////////////////////////////////////////////////////////////////////////////
+// A fixed bias is either wasteful in a sparse scene or too coarse in a dense
+// one, so we adjust it from what the last frame actually cost. Going over
+// budget pushes the bias up quickly, while being comfortably under it brings
+// the detail back slowly so the levels don't flicker back and forth.
+///////////////////////////////////////////////////////////////////////////////
+lod_controller_t lod_controller;
+
+#define LOD_BIAS_STEP_UP   0.25f
+#define LOD_BIAS_STEP_DOWN 0.05f
+#define LOD_MAX_BIAS       (float)(MAX_NUM_LODS - 1)
+
+void lod_controller_init(void)
+{
+    lod_controller.enabled         = false;
+    lod_controller.bias            = 0.0f;
+    lod_controller.triangle_budget = 8000;
+    lod_controller.pixel_budget    = LOD_DEFAULT_PIXEL_BUDGET;
+    lod_controller.frame_time      = 0.0f;
+    lod_controller.num_triangles   = 0;
+    lod_controller.num_pixels      = 0.0f;
+}
+
+void lod_controller_update(float frame_time, float frame_target_time, int num_triangles, float num_pixels, int screen_pixels)
+{
+    lod_controller.frame_time = frame_time;
+    lod_controller.num_triangles = num_triangles;
+    lod_controller.num_pixels = num_pixels;
+
+    if (!lod_controller.enabled)
+    {
+        lod_controller.bias = 0.0f;
+        return;
+    }
+
+    float time_budget = frame_target_time * LOD_BUDGET_HEADROOM;
+    float pixel_budget = lod_controller.pixel_budget * screen_pixels;
+
+    bool over_budget = frame_time > time_budget || num_triangles > lod_controller.triangle_budget ||
+                       num_pixels > pixel_budget;
+    bool under_budget = frame_time < time_budget * 0.7f && num_triangles < lod_controller.triangle_budget * 0.7f &&
+                        num_pixels < pixel_budget * 0.7f;
+
+    if (over_budget)
+        lod_controller.bias += LOD_BIAS_STEP_UP;
+    else if (under_budget)
+        lod_controller.bias -= LOD_BIAS_STEP_DOWN;
+
+    if (lod_controller.bias < 0.0f) lod_controller.bias = 0.0f;
+    if (lod_controller.bias > LOD_MAX_BIAS) lod_controller.bias = LOD_MAX_BIAS;
+}
+
+void get_lod_info(void)
+{
+    printf("============== LOD INFO ==============\n");
+    printf("LOD Controller: %s\n", lod_controller.enabled ? "on" : "off");
+    printf("LOD Bias: %.2f\n", lod_controller.bias);
+    printf("Triangle Budget: %d\n", lod_controller.triangle_budget);
+    printf("Pixel Budget: %.2f screens\n", lod_controller.pixel_budget);
+    printf("Triangles (last frame): %d\n", lod_controller.num_triangles);
+    printf("Pixels (last frame): %.0f\n", lod_controller.num_pixels);
+    printf("Work Time (last frame): %.2fms\n", lod_controller.frame_time);
+
+    for (int i = 0; i < get_num_meshes(); i++)
+    {
+        mesh_t *mesh = get_mesh(i);
+        printf("Mesh %d: LOD %d of %d (%d faces)\n",
+               i, mesh->lod_level, mesh->num_lods, array_length(mesh->lods[mesh->lod_level].faces));
+    }
+    printf("======================================");
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include "vector.h"
+#include "matrix.h"
+#include "mesh.h"
+
+// A mesh is drawn at full detail until its bounding sphere covers fewer pixels than this,
+// then every halving of its on-screen size drops one level of detail
+#define LOD_FULL_DETAIL_PIXELS 256.0f
+
+// Each generated level aims for this fraction of the previous level's faces
+#define LOD_REDUCTION_RATIO 0.5f
+
+// Stop generating levels once a mesh gets this small
+#define LOD_MIN_FACES 64
+
+// The controller aims to keep the frame's work under this fraction of the frame target time
+#define LOD_BUDGET_HEADROOM 0.85f
+
+// Pixel budgets are counted in screens of the render size, so they hold when the size changes.
+// Overdraw counts, a budget of 2 lets the triangles cover every pixel twice
+#define LOD_DEFAULT_PIXEL_BUDGET 2.0f
+
+// Tracks the per-frame triangle and pixel load and biases every mesh's level of detail
+// so the work of a frame fits inside AppState.frame_target_time
+typedef struct
+{
+    bool enabled;          // adjust the bias every frame, otherwise it stays at 0
+    float bias;            // extra levels added on top of each mesh's screen size level
+    int triangle_budget;   // triangles we aim to send to the rasterizer per frame
+    float pixel_budget;    // screens of pixels we aim for those triangles to cover per frame
+    float frame_time;      // milliseconds of update + render work in the last frame
+    int num_triangles;     // triangles sent to the rasterizer in the last frame
+    float num_pixels;      // screen area covered by those triangles in the last frame
+} lod_controller_t;
+
+extern lod_controller_t lod_controller;
+
+void lod_compute_bounds(mesh_t *mesh);
+void lod_generate(mesh_t *mesh);
+void lod_simplify(vec3_t *vertices, face_t *faces, int target_faces, vec3_t **out_vertices, face_t **out_faces);
+float lod_projected_size(mesh_t *mesh, float fovy, int screen_height);
+int lod_select_level(mesh_t *mesh, float projected_size, float bias);
+void lod_free(mesh_t *mesh);
+
+void lod_controller_init(void);
+void lod_controller_update(float frame_time, float frame_target_time, int num_triangles, float num_pixels, int screen_pixels);
+void get_lod_info(void);
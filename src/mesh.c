@@ -4,6 +4,10 @@
 #include "mesh.h"
 #include "array.h"
 #include "display.h"
+#include "lod.h"
+#include "texture_registry.h"
+#include "texture_residency.h"
+#include "clipping.h"
 
 mesh_t m = {
     .vertices = NULL,
@@ -13,10 +17,24 @@ mesh_t m = {
     .translation = {0, 0, 0},
 };
 
-#define MAX_NUM_MESHES 10
 static mesh_t meshes[MAX_NUM_MESHES];
 static int mesh_count = 0;
 
+// A mesh's place in the transform hierarchy. The nodes are packed in their own array,
+// sorted so that every parent comes before its children, so updating the World Matrices
+// is one front-to-back pass that never has to look anything up through mesh_t
+typedef struct
+{
+    mat4_t local_matrix;   // cached scale, rotation and translation
+    mat4_t world_matrix;   // cached parent world * local
+    int parent;            // index of the parent's node, always before this one, -1 for none
+    int mesh;              // index of the mesh this node places
+    bool local_dirty;      // scale, rotation or translation changed since local_matrix was built
+    bool world_changed;    // world_matrix was rebuilt in the last update pass
+} transform_node_t;
+
+static transform_node_t transform_nodes[MAX_NUM_MESHES];
+
 vec3_t cube_vertices[N_CUBE_VERTICES] = {
     {.x = -1, .y = -1, .z = -1}, // 1
     {.x = -1, .y = 1, .z = -1},  // 2
@@ -115,31 +133,364 @@ void load_mesh_obj_data(mesh_t *mesh, const char* obj_file, uint32_t obj_color)
     array_free(texcoords);
 }
 
-void load_mesh(char *obj_file, char *png_file, vec3_t scale, vec3_t translation, vec3_t rotation)
+///////////////////////////////////////////////////////////////////////////////
+// Parse an OBJ file into a mesh that isn't in the mesh table yet, without
+// its texture. It only touches the mesh it's given, so several meshes can be
+// built at once on different threads, then published with add_mesh.
+///////////////////////////////////////////////////////////////////////////////
+void init_mesh(mesh_t *mesh, const char *obj_file, vec3_t scale, vec3_t translation, vec3_t rotation, bool generate_lods)
 {
-    load_mesh_obj_data(&meshes[mesh_count], obj_file, WHITE);
-    load_mesh_png_data(&meshes[mesh_count], png_file);
+    memset(mesh, 0, sizeof(mesh_t));
+    load_mesh_obj_data(mesh, obj_file, WHITE);
+
+    mesh->scale = scale;
+    mesh->translation = translation;
+    mesh->rotation = rotation;
+    mesh->is_static = false;
+    mesh->node = -1;
+    mesh->texture_wrap = TEXTURE_CLAMP;
+    mesh->view_dirty = true;
+    mesh->camera_version = -1;
+
+    // Level 0 is always the mesh as it was loaded
+    mesh->lods[0] = (mesh_lod_t){mesh->vertices, mesh->faces};
+    mesh->num_lods = 1;
+    mesh->lod_level = 0;
+    lod_compute_bounds(mesh);
+
+    if (generate_lods)
+    {
+        lod_generate(mesh);
+    }
+}
 
-    meshes[mesh_count].scale = scale;
-    meshes[mesh_count].translation = translation;
-    meshes[mesh_count].rotation = rotation;
+// Copy a mesh built by init_mesh into the mesh table, which takes over its memory.
+// Returns false if the table is full.
+bool add_mesh(const mesh_t *mesh)
+{
+    if (mesh_count >= MAX_NUM_MESHES)
+        return false;
 
+    // A new mesh has no parent, so it can go at the end of the nodes
+    meshes[mesh_count] = *mesh;
+    meshes[mesh_count].node = mesh_count;
+    transform_nodes[mesh_count] = (transform_node_t){
+        .local_matrix = mat4_identity(),
+        .world_matrix = mat4_identity(),
+        .parent = -1,
+        .mesh = mesh_count,
+        .local_dirty = true,
+        .world_changed = false
+    };
     mesh_count++;
+    return true;
+}
+
+void load_mesh(char *obj_file, char *png_file, vec3_t scale, vec3_t translation, vec3_t rotation, bool generate_lods)
+{
+    mesh_t mesh;
+    init_mesh(&mesh, obj_file, scale, translation, rotation, generate_lods);
+    load_mesh_png_data(&mesh, png_file);
+
+    if (!add_mesh(&mesh))
+    {
+        fprintf(stderr, "Too many meshes, %s was not loaded\n", obj_file);
+        free_mesh(&mesh);
+    }
 }
 
 void load_mesh_png_data(mesh_t *mesh, const char* png_file)
 {
-    upng_t *png_image = upng_new_from_file(png_file);
-    if (png_image != NULL)
+    texture_region_t region;
+    texture_t *texture = acquire_texture(png_file, &region);
+    if (texture != NULL)
+    {
+        mesh_set_texture(mesh, texture, &region, png_file);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Hand the mesh a reference to the texture the registry found for its PNG.
+// If the PNG was packed into an atlas page, the mesh's UVs are moved into its
+// rectangle there. UVs outside 0-1 would sample the neighbors on the page, so
+// a mesh with those loads the PNG again as a texture of its own.
+///////////////////////////////////////////////////////////////////////////////
+void mesh_set_texture(mesh_t *mesh, texture_t *texture, const texture_region_t *region, const char *png_file)
+{
+    bool whole = region->x == 0 && region->y == 0 &&
+        region->width == texture->mips[0].width && region->height == texture->mips[0].height;
+
+    if (!whole && (mesh->texture_wrap == TEXTURE_REPEAT || !mesh_uvs_in_unit_range(mesh)))
+    {
+        free_texture(texture);
+        mesh->texture = texture_residency_load(png_file);
+        return;
+    }
+
+    if (!whole)
+        mesh_remap_uvs(mesh, region, &texture->mips[0]);
+    mesh->texture = texture;
+}
+
+static bool uv_in_unit_range(tex2_t uv)
+{
+    return uv.u >= 0.0f && uv.u <= 1.0f && uv.v >= 0.0f && uv.v <= 1.0f;
+}
+
+bool mesh_uvs_in_unit_range(mesh_t *mesh)
+{
+    for (int level = 0; level < mesh->num_lods; level++)
+    {
+        face_t *faces = mesh->lods[level].faces;
+        for (int i = 0; i < array_length(faces); i++)
+        {
+            if (!uv_in_unit_range(faces[i].a_uv) || !uv_in_unit_range(faces[i].b_uv) || !uv_in_unit_range(faces[i].c_uv))
+                return false;
+        }
+    }
+    return true;
+}
+
+// Map a UV of the whole image into its region of a page, keeping the clamp
+// sampler's u * (width - 1) texel mapping. V is flipped before sampling, so
+// the region's top row is v = 1
+static tex2_t remap_uv(tex2_t uv, const texture_region_t *region, const mip_level_t *page)
+{
+    float page_u = (region->x + uv.u * (region->width - 1)) / (page->width - 1);
+    float page_v = (region->y + (1.0f - uv.v) * (region->height - 1)) / (page->height - 1);
+    return (tex2_t){page_u, 1.0f - page_v};
+}
+
+// Move every level of detail's UVs into a region of an atlas page
+void mesh_remap_uvs(mesh_t *mesh, const texture_region_t *region, const mip_level_t *page)
+{
+    for (int level = 0; level < mesh->num_lods; level++)
+    {
+        face_t *faces = mesh->lods[level].faces;
+        for (int i = 0; i < array_length(faces); i++)
+        {
+            faces[i].a_uv = remap_uv(faces[i].a_uv, region, page);
+            faces[i].b_uv = remap_uv(faces[i].b_uv, region, page);
+            faces[i].c_uv = remap_uv(faces[i].c_uv, region, page);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Tile the mesh's texture u_repeat times across and v_repeat times down,
+// by scaling the UVs of every level of detail and switching the mesh to
+// repeat, e.g. to cover a large runway or grass field with a small texture.
+// Other meshes sharing the texture keep clamping it. Call it before
+// build_texture_atlases, a repeating texture needs a texture of its own, and before
+// build_static_batches, batches keep their own copy of the UVs.
+///////////////////////////////////////////////////////////////////////////////
+void mesh_set_texture_repeat(mesh_t *mesh, float u_repeat, float v_repeat)
+{
+    for (int level = 0; level < mesh->num_lods; level++)
+    {
+        face_t *faces = mesh->lods[level].faces;
+        for (int i = 0; i < array_length(faces); i++)
+        {
+            faces[i].a_uv.u *= u_repeat;
+            faces[i].a_uv.v *= v_repeat;
+            faces[i].b_uv.u *= u_repeat;
+            faces[i].b_uv.v *= v_repeat;
+            faces[i].c_uv.u *= u_repeat;
+            faces[i].c_uv.v *= v_repeat;
+        }
+    }
+
+    mesh->texture_wrap = TEXTURE_REPEAT;
+}
+
+// The mesh's transform relative to its parent (or to the world if it has none)
+mat4_t mesh_get_local_matrix(mesh_t *mesh)
+{
+    // Create a scale, translation, and rotation matrix that will be used to transform our mesh vertices
+    mat4_t scale_matrix = mat4_make_scale(mesh->scale.x, mesh->scale.y, mesh->scale.z);
+    mat4_t rotation_matrix_x = mat4_make_rotation_x(mesh->rotation.x);
+    mat4_t rotation_matrix_y = mat4_make_rotation_y(mesh->rotation.y);
+    mat4_t rotation_matrix_z = mat4_make_rotation_z(mesh->rotation.z);
+    mat4_t translation_matrix = mat4_make_translation(mesh->translation.x, mesh->translation.y, mesh->translation.z);
+
+    // Create a Local Matrix that combines our scale, rotation, and translation matrices
+    mat4_t local_matrix = mat4_identity();
+
+    // Order matters: First scale, then rotate, then translate (AxB != BxA)
+    local_matrix = mat4_mul_mat4(scale_matrix, local_matrix);
+    local_matrix = mat4_mul_mat4(rotation_matrix_x, local_matrix);
+    local_matrix = mat4_mul_mat4(rotation_matrix_y, local_matrix);
+    local_matrix = mat4_mul_mat4(rotation_matrix_z, local_matrix);
+    local_matrix = mat4_mul_mat4(translation_matrix, local_matrix);
+
+    return local_matrix;
+}
+
+// The World Matrix update_mesh_transforms last built for the mesh
+mat4_t mesh_get_world_matrix(const mesh_t *mesh)
+{
+    return transform_nodes[mesh->node].world_matrix;
+}
+
+// Index of the mesh whose transform this one follows, -1 for none
+int mesh_get_parent(int mesh_index)
+{
+    int parent_node = transform_nodes[meshes[mesh_index].node].parent;
+    return parent_node >= 0 ? transform_nodes[parent_node].mesh : -1;
+}
+
+static int node_depth(int node)
+{
+    int depth = 0;
+    for (int ancestor = transform_nodes[node].parent; ancestor >= 0; ancestor = transform_nodes[ancestor].parent)
+    {
+        depth++;
+    }
+    return depth;
+}
+
+// Attach a mesh to a parent (or detach it with -1), so it moves along with the parent.
+// Returns false if either index is out of range or that would make a mesh its own ancestor.
+bool mesh_set_parent(int child_index, int parent_index)
+{
+    if (child_index < 0 || child_index >= mesh_count || parent_index < -1 || parent_index >= mesh_count)
+        return false;
+
+    int child_node = meshes[child_index].node;
+    int parent_node = parent_index >= 0 ? meshes[parent_index].node : -1;
+    for (int ancestor = parent_node; ancestor >= 0; ancestor = transform_nodes[ancestor].parent)
+    {
+        if (ancestor == child_node)
+            return false;
+    }
+
+    transform_nodes[child_node].parent = parent_node;
+    transform_nodes[child_node].local_dirty = true;
+
+    // Sort the nodes by depth in the hierarchy again, so one front-to-back pass always sees a
+    // parent first. Insertion sort keeps nodes at the same depth in the order they were in
+    int depths[MAX_NUM_MESHES];
+    int order[MAX_NUM_MESHES];
+    for (int i = 0; i < mesh_count; i++)
+    {
+        depths[i] = node_depth(i);
+
+        int j = i - 1;
+        while (j >= 0 && depths[order[j]] > depths[i])
+        {
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = i;
+    }
+
+    // Move the nodes into their new places, a parent always moves before its children
+    transform_node_t sorted[MAX_NUM_MESHES];
+    int new_index[MAX_NUM_MESHES];
+    for (int i = 0; i < mesh_count; i++)
+    {
+        sorted[i] = transform_nodes[order[i]];
+        new_index[order[i]] = i;
+        if (sorted[i].parent >= 0)
+            sorted[i].parent = new_index[sorted[i].parent];
+        meshes[sorted[i].mesh].node = i;
+    }
+    memcpy(transform_nodes, sorted, sizeof(transform_node_t) * mesh_count);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Update every mesh's World Matrix in one pass over the transform nodes.
+// A node is only recomputed when its own transform changed or its parent's
+// World Matrix changed earlier in this same pass, so untouched subtrees
+// cost nothing.
+///////////////////////////////////////////////////////////////////////////////
+void update_mesh_transforms(void)
+{
+    for (int i = 0; i < mesh_count; i++)
     {
-        upng_decode(png_image);
-        if (upng_get_error(png_image) == UPNG_EOK)
+        transform_node_t *node = &transform_nodes[i];
+
+        bool parent_changed = node->parent >= 0 && transform_nodes[node->parent].world_changed;
+        node->world_changed = node->local_dirty || parent_changed;
+        if (!node->world_changed)
+            continue;
+
+        if (node->local_dirty)
         {
-            mesh->texture = png_image;
+            node->local_matrix = mesh_get_local_matrix(&meshes[node->mesh]);
+            node->local_dirty = false;
         }
+
+        if (node->parent >= 0)
+            node->world_matrix = mat4_mul_mat4(transform_nodes[node->parent].world_matrix, node->local_matrix);
+        else
+            node->world_matrix = node->local_matrix;
+
+        meshes[node->mesh].view_dirty = true;
     }
 }
 
+// Flag the mesh's local matrix to be rebuilt, meshes outside the table are built when they're added
+static void mark_transform_dirty(mesh_t *mesh)
+{
+    if (mesh->node >= 0)
+        transform_nodes[mesh->node].local_dirty = true;
+}
+
+// Rebuild the World-View and MVP matrices when either the mesh or the camera moved,
+// update_mesh_transforms has already brought the World Matrix up to date
+void mesh_update_matrices(mesh_t *mesh, mat4_t view_matrix, mat4_t proj_matrix, int camera_version)
+{
+    if (mesh->view_dirty || mesh->camera_version != camera_version)
+    {
+        mesh->world_view_matrix = mat4_mul_mat4(view_matrix, transform_nodes[mesh->node].world_matrix);
+        mesh->mvp_matrix = mat4_mul_mat4(proj_matrix, mesh->world_view_matrix);
+        mesh->camera_version = camera_version;
+        mesh->view_dirty = false;
+    }
+}
+
+// Radius of the mesh's bounding sphere in camera space.
+// The view matrix doesn't scale, so the longest basis vector is the mesh's largest scale
+float mesh_view_radius(mesh_t *mesh)
+{
+    float scale = 0.0f;
+    for (int col = 0; col < 3; col++)
+    {
+        vec3_t axis = {mesh->world_view_matrix.m[0][col], mesh->world_view_matrix.m[1][col], mesh->world_view_matrix.m[2][col]};
+        float length = vec3_length(axis);
+        if (length > scale) scale = length;
+    }
+    return mesh->bounds_radius * scale;
+}
+
+// False if the mesh's bounding sphere is entirely outside the view frustum, using its cached matrices
+bool mesh_in_frustum(mesh_t *mesh)
+{
+    vec3_t center = vec3_from_vec4(mat4_mul_vec4(mesh->world_view_matrix, vec4_from_vec3(mesh->bounds_center)));
+    return sphere_in_frustum(center, mesh_view_radius(mesh));
+}
+
+// Always move meshes through these, so the cached matrices know to rebuild
+void mesh_set_scale(mesh_t *mesh, vec3_t scale)
+{
+    mesh->scale = scale;
+    mark_transform_dirty(mesh);
+}
+
+void mesh_set_rotation(mesh_t *mesh, vec3_t rotation)
+{
+    mesh->rotation = rotation;
+    mark_transform_dirty(mesh);
+}
+
+void mesh_set_translation(mesh_t *mesh, vec3_t translation)
+{
+    mesh->translation = translation;
+    mark_transform_dirty(mesh);
+}
+
 mesh_t* get_mesh(int index)
 {
     return &meshes[index];
@@ -150,16 +501,22 @@ int get_num_meshes(void)
     return mesh_count;
 }
 
+void free_mesh(mesh_t *mesh)
+{
+    lod_free(mesh);
+    array_free(mesh->faces);
+    array_free(mesh->vertices);
+    if (mesh->texture)
+    {
+        free_texture(mesh->texture);
+        mesh->texture = NULL;
+    }
+}
+
 void free_meshes(void)
 {
     for (int i = 0; i < mesh_count; i++)
     {
-        array_free(meshes[i].faces);
-        array_free(meshes[i].vertices);
-        if (meshes[i].texture)
-        {
-            upng_free(meshes[i].texture);
-            meshes[i].texture = NULL;
-        }
+        free_mesh(&meshes[i]);
     }
 }
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <stdbool.h>
 #include "vector.h"
+#include "matrix.h"
 #include "triangle.h"
-#include "upng.h"
+#include "texture.h"
 
 #define N_CUBE_VERTICES 8
 extern vec3_t cube_vertices[N_CUBE_VERTICES];
@@ -10,24 +12,66 @@ extern vec3_t cube_vertices[N_CUBE_VERTICES];
 #define N_CUBE_FACES (6 * 2) // 6 cube faces, 2 triangles per face
 extern face_t cube_faces[N_CUBE_FACES];
 
+// Level 0 is the full detail mesh, every level after it has roughly half the faces
+#define MAX_NUM_LODS 4
+#define MAX_NUM_MESHES 10
+
+// A single level of detail, the faces index into this level's own vertices
+typedef struct {
+   vec3_t* vertices;   // dynamic array of vertices
+   face_t* faces;      // dynamic array of faces
+} mesh_lod_t;
+
 // This is a struct for dynamic size meshes
 typedef struct {
    vec3_t* vertices;   // dynamic array of vertices
    face_t* faces;      // dynamic array of faces
-   upng_t* texture;    // mesh PNG texture pointer
+   texture_t* texture; // mesh PNG texture and its mip chain
+   enum Texture_Wrap texture_wrap; // how UVs outside 0-1 sample the texture, it may be shared so this is the mesh's
    vec3_t rotation;    // rotation with x, y, and z values
    vec3_t scale;       // scale with x, y, and z
    vec3_t translation; // translate with x, y, and z values
+   bool is_static;     // never moves, so it can be merged into a static batch
+   int node;                   // the mesh's transform node (see mesh.c), -1 until it's in the mesh table
+   bool view_dirty;            // the World Matrix changed since world_view and mvp were built
+   int camera_version;         // camera version the world_view and mvp matrices were built with
+   mat4_t world_view_matrix;   // cached view * world
+   mat4_t mvp_matrix;          // cached projection * view * world
+   mesh_lod_t lods[MAX_NUM_LODS]; // lods[0] shares the vertices and faces above
+   int num_lods;                  // number of valid entries in lods
+   int lod_level;                 // level of detail selected for the current frame
+   vec3_t bounds_center;          // model space center of the bounding sphere
+   float bounds_radius;           // model space radius of the bounding sphere
 } mesh_t;
 
 extern mesh_t m;
 
 void load_cube_mesh_data(void);
 void load_mesh_obj_data(mesh_t *mesh, const char *obj_file, uint32_t obj_color);
-void load_mesh(char *obj_file, char *png_file, vec3_t scale, vec3_t translation, vec3_t rotation);
+void init_mesh(mesh_t *mesh, const char *obj_file, vec3_t scale, vec3_t translation, vec3_t rotation, bool generate_lods);
+bool add_mesh(const mesh_t *mesh);
+void load_mesh(char *obj_file, char *png_file, vec3_t scale, vec3_t translation, vec3_t rotation, bool generate_lods);
 void load_mesh_png_data(mesh_t *mesh, const char* png_file);
+void mesh_set_texture(mesh_t *mesh, texture_t *texture, const texture_region_t *region, const char *png_file);
+bool mesh_uvs_in_unit_range(mesh_t *mesh);
+void mesh_remap_uvs(mesh_t *mesh, const texture_region_t *region, const mip_level_t *page);
+
+void mesh_set_texture_repeat(mesh_t *mesh, float u_repeat, float v_repeat);
+
+mat4_t mesh_get_local_matrix(mesh_t *mesh);
+mat4_t mesh_get_world_matrix(const mesh_t *mesh);
+bool mesh_set_parent(int child_index, int parent_index);
+int mesh_get_parent(int mesh_index);
+void update_mesh_transforms(void);
+void mesh_update_matrices(mesh_t *mesh, mat4_t view_matrix, mat4_t proj_matrix, int camera_version);
+float mesh_view_radius(mesh_t *mesh);
+bool mesh_in_frustum(mesh_t *mesh);
+void mesh_set_scale(mesh_t *mesh, vec3_t scale);
+void mesh_set_rotation(mesh_t *mesh, vec3_t rotation);
+void mesh_set_translation(mesh_t *mesh, vec3_t translation);
 
 mesh_t* get_mesh(int mesh_index);
 int get_num_meshes(void);
 
+void free_mesh(mesh_t *mesh);
 void free_meshes(void);
\ No newline at end of file
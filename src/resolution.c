@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <math.h>
+#include "resolution.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Dynamic resolution
+///////////////////////////////////////////////////////////////////////////////
+// Rasterizing costs about the same per pixel, so a frame that fills the
+// screen with a close-up aircraft takes far longer than one of the whole
+// scene far away. Rather than let the frame rate drop, frames are drawn at
+// a smaller internal size and the present stretches them to the screen.
+//
+// Raster time goes with the number of pixels, the square of the scale. Going
+// over budget drops straight to the scale that would have fit, while a step
+// back up is only taken once the larger frame is predicted to fit with room
+// to spare, so the size doesn't flicker back and forth between two steps.
+///////////////////////////////////////////////////////////////////////////////
+resolution_controller_t resolution_controller;
+
+// Only step up if the next step's predicted raster time is under this fraction of the budget
+#define RESOLUTION_STEP_UP_MARGIN 0.8f
+
+void resolution_controller_init(void)
+{
+    resolution_controller.enabled     = false;
+    resolution_controller.scale       = 1.0f;
+    resolution_controller.min_scale   = 0.5f;
+    resolution_controller.max_scale   = 1.0f;
+    resolution_controller.raster_time = 0.0f;
+}
+
+// Keep the bounds between one step and the full size, with the minimum no larger than the maximum
+void resolution_controller_set_bounds(float min_scale, float max_scale)
+{
+    if (max_scale > 1.0f) max_scale = 1.0f;
+    if (max_scale < RESOLUTION_SCALE_STEP) max_scale = RESOLUTION_SCALE_STEP;
+    if (min_scale < RESOLUTION_SCALE_STEP) min_scale = RESOLUTION_SCALE_STEP;
+    if (min_scale > max_scale) min_scale = max_scale;
+
+    resolution_controller.min_scale = min_scale;
+    resolution_controller.max_scale = max_scale;
+}
+
+void resolution_controller_update(float raster_time, float frame_target_time)
+{
+    resolution_controller.raster_time = raster_time;
+
+    if (!resolution_controller.enabled)
+    {
+        resolution_controller.scale = 1.0f;
+        return;
+    }
+
+    float scale = resolution_controller.scale;
+    float time_budget = frame_target_time * RESOLUTION_BUDGET_HEADROOM;
+
+    if (raster_time > time_budget)
+    {
+        // The scale that would have fit, rounded down to a step, and at least one step down
+        float fit = floorf(scale * sqrtf(time_budget / raster_time) / RESOLUTION_SCALE_STEP) * RESOLUTION_SCALE_STEP;
+        scale = fit < scale - RESOLUTION_SCALE_STEP ? fit : scale - RESOLUTION_SCALE_STEP;
+    }
+    else
+    {
+        float next = scale + RESOLUTION_SCALE_STEP;
+        float predicted_time = raster_time * (next * next) / (scale * scale);
+        if (predicted_time < time_budget * RESOLUTION_STEP_UP_MARGIN)
+            scale = next;
+    }
+
+    if (scale < resolution_controller.min_scale) scale = resolution_controller.min_scale;
+    if (scale > resolution_controller.max_scale) scale = resolution_controller.max_scale;
+    resolution_controller.scale = scale;
+}
+
+// Draw the next frames at the controller's scale of the window's full render size
+void resolution_controller_apply(Window *w)
+{
+    int width = (int)(w->max_width * resolution_controller.scale + 0.5f);
+    int height = (int)(w->max_height * resolution_controller.scale + 0.5f);
+    window_set_render_size(w, width, height);
+}
+
+void get_resolution_info(Window *w)
+{
+    printf("=========== RESOLUTION INFO ==========\n");
+    printf("Resolution Controller: %s\n", resolution_controller.enabled ? "on" : "off");
+    printf("Scale: %.4f (%.2f to %.2f)\n", resolution_controller.scale, resolution_controller.min_scale, resolution_controller.max_scale);
+    printf("Render Size: %dx%d of %dx%d\n", w->width, w->height, w->max_width, w->max_height);
+    printf("Raster Time (last frame): %.2fms\n", resolution_controller.raster_time);
+    printf("======================================");
+}
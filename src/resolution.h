@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include "display.h"
+
+// The controller aims to keep rasterizing a frame under this fraction of the frame target time,
+// update() and the present need the rest
+#define RESOLUTION_BUDGET_HEADROOM 0.75f
+
+// The render size changes in steps of this fraction of the full size, so small changes
+// in the raster time don't resize the frame every time
+#define RESOLUTION_SCALE_STEP 0.0625f
+
+// Measures how long frames take to rasterize and scales the internal render size (the
+// same fraction of the full size on both axes) so a frame fits inside AppState.frame_target_time
+typedef struct
+{
+    bool enabled;       // adjust the scale every frame, otherwise frames are drawn at full size
+    float scale;        // fraction of the full render size frames are drawn at
+    float min_scale;    // the scale never goes below this, however slow the frames are
+    float max_scale;    // or above this, however fast
+    float raster_time;  // milliseconds the last frame took to rasterize
+} resolution_controller_t;
+
+extern resolution_controller_t resolution_controller;
+
+void resolution_controller_init(void);
+void resolution_controller_set_bounds(float min_scale, float max_scale);
+void resolution_controller_update(float raster_time, float frame_target_time);
+void resolution_controller_apply(Window *w);
+void get_resolution_info(Window *w);
@@ -1,7 +1,538 @@
 #include "texture.h"
+#include "texture_cache.h"
+#include "texture_registry.h"
+#include "texture_residency.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <limits.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 tex2_t tex2_clone(tex2_t *t)
 {
     return (tex2_t){t->u, t->v};
-}
\ No newline at end of file
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Load a texture and its mip chain, returns NULL if it can't be read.
+// A fresh texture cache file next to the PNG is mapped straight into memory,
+// otherwise the PNG is decoded and a new cache file is written for next time.
+///////////////////////////////////////////////////////////////////////////////
+texture_t* load_texture(const char *png_file)
+{
+    texture_t *cached = texture_cache_load(png_file);
+    if (cached != NULL)
+        return cached;
+
+    upng_t *png_image = upng_new_from_file(png_file);
+    if (png_image == NULL)
+        return NULL;
+
+    upng_decode(png_image);
+    if (upng_get_error(png_image) != UPNG_EOK)
+    {
+        upng_free(png_image);
+        return NULL;
+    }
+
+    texture_t *texture = calloc(1, sizeof(texture_t));
+    texture->png = png_image;
+    texture->layout = TEXTURE_LINEAR;
+    texture->mips[0].texels = (uint32_t*)upng_get_buffer(png_image);
+    texture->mips[0].width = upng_get_width(png_image);
+    texture->mips[0].height = upng_get_height(png_image);
+    texture->mips[0].tiles_x = (texture->mips[0].width + TEXTURE_TILE_MASK) >> TEXTURE_TILE_SHIFT;
+    texture->mips[0].layout = TEXTURE_LINEAR;
+    texture->num_mips = 1;
+    texture->ref_count = 1;
+
+    // The box filter reads the levels row by row, so convert them only once they're built
+    texture_build_mips(texture, MAX_NUM_MIPS);
+    texture_set_layout(texture, TEXTURE_DEFAULT_LAYOUT);
+
+    texture_cache_save(texture, png_file);
+
+    return texture;
+}
+
+// Average 4 RGBA texels one 8-bit channel at a time, rounding to nearest
+static uint32_t average_texels(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+    uint32_t result = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        uint32_t sum = ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF) + ((c >> shift) & 0xFF) + ((d >> shift) & 0xFF);
+        result |= ((sum + 2) / 4) << shift;
+    }
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Box filter each level down from the previous one until we reach 1x1,
+// or max_mips levels. Odd sizes round down, the last row or column of the
+// bigger level is folded in by clamping the 2x2 footprint to the level's edge.
+///////////////////////////////////////////////////////////////////////////////
+void texture_build_mips(texture_t *texture, int max_mips)
+{
+    if (max_mips > MAX_NUM_MIPS)
+        max_mips = MAX_NUM_MIPS;
+
+    while (texture->num_mips < max_mips)
+    {
+        mip_level_t *src = &texture->mips[texture->num_mips - 1];
+        if (src->width == 1 && src->height == 1)
+            break;
+
+        mip_level_t *dst = &texture->mips[texture->num_mips];
+        dst->width = src->width > 1 ? src->width / 2 : 1;
+        dst->height = src->height > 1 ? src->height / 2 : 1;
+        dst->tiles_x = (dst->width + TEXTURE_TILE_MASK) >> TEXTURE_TILE_SHIFT;
+        dst->layout = TEXTURE_LINEAR;
+        dst->texels = malloc((size_t)dst->width * dst->height * sizeof(uint32_t));
+
+        for (int y = 0; y < dst->height; y++)
+        {
+            int y0 = y * 2;
+            int y1 = (y0 + 1 < src->height) ? y0 + 1 : y0;
+            for (int x = 0; x < dst->width; x++)
+            {
+                int x0 = x * 2;
+                int x1 = (x0 + 1 < src->width) ? x0 + 1 : x0;
+                dst->texels[(dst->width * y) + x] = average_texels(
+                    src->texels[(src->width * y0) + x0],
+                    src->texels[(src->width * y0) + x1],
+                    src->texels[(src->width * y1) + x0],
+                    src->texels[(src->width * y1) + x1]
+                );
+            }
+        }
+
+        texture->num_mips++;
+    }
+}
+
+// 32-bit words in a mip level's buffer, including the padding of partial tiles
+size_t mip_level_num_texels(const mip_level_t *mip)
+{
+    if (mip->layout == TEXTURE_LINEAR)
+        return (size_t)mip->width * mip->height;
+
+    int tiles_y = (mip->height + TEXTURE_TILE_MASK) >> TEXTURE_TILE_SHIFT;
+    if (mip->layout == TEXTURE_BC1)
+        return (size_t)mip->tiles_x * tiles_y * BC1_BLOCK_WORDS;
+
+    return (size_t)mip->tiles_x * tiles_y * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;
+}
+
+// Round a channel to the given number of bits, the inverse of bc1_endpoint_to_texel's widening
+static uint32_t quantize_channel(int value, int bits)
+{
+    int max = (1 << bits) - 1;
+    int quantized = (value * max + 127) / 255;
+    return quantized < 0 ? 0 : (quantized > max ? max : quantized);
+}
+
+static uint32_t rgb_to_565(int r, int g, int b)
+{
+    return (quantize_channel(r, 5) << 11) | (quantize_channel(g, 6) << 5) | quantize_channel(b, 5);
+}
+
+static int color_distance(uint32_t a, uint32_t b)
+{
+    int distance = 0;
+    for (int shift = 0; shift < 24; shift += 8)
+    {
+        int d = (int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF);
+        distance += d * d;
+    }
+    return distance;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Compress one 4x4 block of texels to BC1.
+// The endpoints are the corners of the block's RGB bounding box, inset by a
+// sixteenth of its size since the extremes are rarely worth a whole endpoint.
+// The box's main diagonal runs from all-min to all-max, so any channel that
+// falls while red or green rises gets its corners swapped to follow the
+// colors instead. Each texel then takes whichever of the four palette colors
+// is closest. Blocks with any texel under half alpha use the 3 color mode,
+// and those texels become transparent black.
+///////////////////////////////////////////////////////////////////////////////
+static void bc1_encode_block(const uint32_t texels[16], uint32_t block[BC1_BLOCK_WORDS])
+{
+    int min[3] = {255, 255, 255};
+    int max[3] = {0, 0, 0};
+    int mean[3] = {0, 0, 0};
+    int num_opaque = 0;
+
+    for (int i = 0; i < 16; i++)
+    {
+        if ((texels[i] >> 24) < 128)
+            continue;
+        for (int c = 0; c < 3; c++)
+        {
+            int value = (texels[i] >> (c * 8)) & 0xFF;
+            min[c] = value < min[c] ? value : min[c];
+            max[c] = value > max[c] ? value : max[c];
+            mean[c] += value;
+        }
+        num_opaque++;
+    }
+
+    if (num_opaque == 0)
+    {
+        // Fully transparent, equal endpoints select 3 color mode and every texel picks transparent
+        block[0] = 0;
+        block[1] = 0xFFFFFFFF;
+        return;
+    }
+
+    // Covariance of each channel with the one that varies the most decides the diagonal
+    int axis = 0;
+    for (int c = 1; c < 3; c++)
+    {
+        if (max[c] - min[c] > max[axis] - min[axis])
+            axis = c;
+    }
+    for (int c = 0; c < 3; c++)
+        mean[c] /= num_opaque;
+
+    int start[3];
+    int end[3];
+    for (int c = 0; c < 3; c++)
+    {
+        int covariance = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            if ((texels[i] >> 24) < 128)
+                continue;
+            int value = (texels[i] >> (c * 8)) & 0xFF;
+            int axis_value = (texels[i] >> (axis * 8)) & 0xFF;
+            covariance += (value - mean[c]) * (axis_value - mean[axis]);
+        }
+
+        int inset = (max[c] - min[c]) / 16;
+        start[c] = min[c] + inset;
+        end[c] = max[c] - inset;
+        if (covariance < 0)
+        {
+            int swap = start[c];
+            start[c] = end[c];
+            end[c] = swap;
+        }
+    }
+
+    uint32_t color0 = rgb_to_565(end[0], end[1], end[2]);
+    uint32_t color1 = rgb_to_565(start[0], start[1], start[2]);
+
+    // The endpoint order picks the mode, larger first for 4 colors, smaller first for 3 and transparent
+    bool has_transparent = num_opaque < 16;
+    if ((color0 < color1) != has_transparent && color0 != color1)
+    {
+        uint32_t swap = color0;
+        color0 = color1;
+        color1 = swap;
+    }
+    block[0] = color0 | (color1 << 16);
+
+    // Solid blocks land in 3 color mode, selector 0 still holds their color
+    int num_colors = color0 > color1 ? 4 : 3;
+    uint32_t palette[4];
+    for (int selector = 0; selector < 4; selector++)
+        palette[selector] = bc1_block_color(block[0], selector);
+
+    block[1] = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int best = 3;
+        if ((texels[i] >> 24) >= 128)
+        {
+            int best_distance = INT_MAX;
+            for (int selector = 0; selector < num_colors; selector++)
+            {
+                int distance = color_distance(texels[i], palette[selector]);
+                if (distance < best_distance)
+                {
+                    best_distance = distance;
+                    best = selector;
+                }
+            }
+        }
+        block[1] |= (uint32_t)best << (2 * i);
+    }
+}
+
+// Compress a whole mip level, partial blocks at the edges repeat the last row or column
+static void bc1_encode_mip(const mip_level_t *src, mip_level_t *dst)
+{
+    int tiles_y = (src->height + TEXTURE_TILE_MASK) >> TEXTURE_TILE_SHIFT;
+    for (int tile_y = 0; tile_y < tiles_y; tile_y++)
+    {
+        for (int tile_x = 0; tile_x < src->tiles_x; tile_x++)
+        {
+            uint32_t texels[16];
+            for (int i = 0; i < 16; i++)
+            {
+                int x = (tile_x << TEXTURE_TILE_SHIFT) + (i & TEXTURE_TILE_MASK);
+                int y = (tile_y << TEXTURE_TILE_SHIFT) + (i >> TEXTURE_TILE_SHIFT);
+                x = x < src->width ? x : src->width - 1;
+                y = y < src->height ? y : src->height - 1;
+                texels[i] = mip_level_fetch(src, x, y);
+            }
+
+            int tile = (tile_y * dst->tiles_x) + tile_x;
+            bc1_encode_block(texels, &dst->texels[tile * BC1_BLOCK_WORDS]);
+        }
+    }
+}
+
+// Buffers that belong to the PNG or to a mapped cache file aren't ours to free
+static bool texture_owns_texels(const texture_t *texture, const uint32_t *texels)
+{
+    if (texture->png && texels == (const uint32_t*)upng_get_buffer(texture->png))
+        return false;
+
+    const char *mapping = texture->cache_mapping;
+    if (mapping && (const char*)texels >= mapping && (const char*)texels < mapping + texture->cache_size)
+        return false;
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reorder every mip level's texels into the given layout.
+// Rotated triangles walk the texture along V as often as along U, in row-major
+// order that's a new cache line for almost every texel, while a 4x4 tile keeps
+// the neighbors in both directions inside the same 64 bytes.
+// BC1 goes further and squeezes each tile into 8 bytes, so the sampler moves
+// an eighth of the memory at the cost of decoding every fetch. It's lossy,
+// going back to an uncompressed layout keeps the compressed colors, except
+// for the first level of a linear texture, which the PNG still holds.
+///////////////////////////////////////////////////////////////////////////////
+void texture_set_layout(texture_t *texture, enum Texture_Layout layout)
+{
+    if (texture->layout == layout)
+        return;
+
+    for (int i = 0; i < texture->num_mips; i++)
+    {
+        texture_set_mip_layout(texture, i, layout);
+    }
+
+    texture->layout = layout;
+}
+
+// Convert a single level, levels that aren't in memory only take note of the layout
+void texture_set_mip_layout(texture_t *texture, int level, enum Texture_Layout layout)
+{
+    mip_level_t *mip = &texture->mips[level];
+    if (mip->layout == layout)
+        return;
+
+    mip_level_t converted = *mip;
+    converted.layout = layout;
+
+    if (mip->texels == NULL)
+    {
+        *mip = converted;
+        return;
+    }
+
+    if (level == 0 && layout == TEXTURE_LINEAR && texture->png)
+    {
+        // The PNG still holds the linear texels
+        converted.texels = (uint32_t*)upng_get_buffer(texture->png);
+    }
+    else
+    {
+        converted.texels = calloc(mip_level_num_texels(&converted), sizeof(uint32_t));
+
+        if (layout == TEXTURE_BC1)
+        {
+            bc1_encode_mip(mip, &converted);
+        }
+        else
+        {
+            for (int y = 0; y < mip->height; y++)
+            {
+                for (int x = 0; x < mip->width; x++)
+                {
+                    converted.texels[texel_index(&converted, x, y)] = mip_level_fetch(mip, x, y);
+                }
+            }
+        }
+    }
+
+    // BC1 is an eighth the size, and the residency budget counts the level's bytes
+    if (texture->managed)
+        texture_residency_resize_level(mip_level_num_texels(mip) * sizeof(uint32_t), mip_level_num_texels(&converted) * sizeof(uint32_t));
+
+    if (texture_owns_texels(texture, mip->texels))
+        free(mip->texels);
+
+    *mip = converted;
+}
+
+static bool is_power_of_two(int n)
+{
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+// Resolve the descriptor the rasterizer samples one mip level through,
+// or the finest level in memory if that one isn't. The wrap mode belongs to
+// the mesh, the same texture can be clamped on one mesh and tiled on another
+sampler_t texture_get_sampler(texture_t *texture, int mip_level, enum Texture_Wrap wrap, enum Texture_Filter filter)
+{
+    if (mip_level < texture->resident_mip)
+        mip_level = texture->resident_mip;
+
+    mip_level_t *mip = &texture->mips[mip_level];
+    return (sampler_t){
+        .mip = *mip,
+        .width_mask = is_power_of_two(mip->width) ? mip->width - 1 : -1,
+        .height_mask = is_power_of_two(mip->height) ? mip->height - 1 : -1,
+        .wrap = wrap,
+        .filter = filter
+    };
+}
+
+// Bring a texel coordinate that may be one step outside the level back inside it
+static int wrap_coordinate(int coordinate, int size, int mask, enum Texture_Wrap wrap)
+{
+    if (wrap == TEXTURE_REPEAT)
+        return mask >= 0 ? coordinate & mask : ((coordinate % size) + size) % size;
+
+    return coordinate < 0 ? 0 : (coordinate >= size ? size - 1 : coordinate);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fetch the 2x2 texels around (u, v) and blend them by the sample point's
+// position between them. The weights are 8-bit fixed point (0-256), so with
+// SSE2 all four 8-bit channels of a texel are blended at once in 16-bit lanes:
+// left and right columns first, for the top and bottom rows together, then
+// the top row against the bottom row.
+///////////////////////////////////////////////////////////////////////////////
+uint32_t sampler_fetch_bilinear(const sampler_t *sampler, float u, float v)
+{
+    const mip_level_t *mip = &sampler->mip;
+
+    // Clamp matches the nearest texel mapping, repeat samples between texel centers
+    float tex_u;
+    float tex_v;
+    if (sampler->wrap == TEXTURE_REPEAT)
+    {
+        tex_u = u * mip->width - 0.5f;
+        tex_v = v * mip->height - 0.5f;
+    }
+    else
+    {
+        tex_u = u * (mip->width - 1);
+        tex_v = v * (mip->height - 1);
+    }
+
+    float floor_u = floorf(tex_u);
+    float floor_v = floorf(tex_v);
+    int weight_x = (int)((tex_u - floor_u) * 256.0f);
+    int weight_y = (int)((tex_v - floor_v) * 256.0f);
+
+    int x0 = wrap_coordinate((int)floor_u, mip->width, sampler->width_mask, sampler->wrap);
+    int x1 = wrap_coordinate((int)floor_u + 1, mip->width, sampler->width_mask, sampler->wrap);
+    int y0 = wrap_coordinate((int)floor_v, mip->height, sampler->height_mask, sampler->wrap);
+    int y1 = wrap_coordinate((int)floor_v + 1, mip->height, sampler->height_mask, sampler->wrap);
+
+    uint32_t top_left = mip_level_fetch(mip, x0, y0);
+    uint32_t top_right = mip_level_fetch(mip, x1, y0);
+    uint32_t bottom_left = mip_level_fetch(mip, x0, y1);
+    uint32_t bottom_right = mip_level_fetch(mip, x1, y1);
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+
+    // 16-bit channels, the top row's texel in the low half and the bottom row's in the high half
+    __m128i left = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128(top_left), _mm_cvtsi32_si128(bottom_left)), zero);
+    __m128i right = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128(top_right), _mm_cvtsi32_si128(bottom_right)), zero);
+
+    // left * (256 - wx) + right * wx tops out at 255 * 256, which still fits an unsigned 16-bit lane
+    __m128i rows = _mm_add_epi16(
+        _mm_mullo_epi16(left, _mm_set1_epi16(256 - weight_x)),
+        _mm_mullo_epi16(right, _mm_set1_epi16(weight_x))
+    );
+    rows = _mm_srli_epi16(rows, 8);
+
+    // Weight the top row by (256 - wy) and the bottom row by wy, then add the halves together
+    __m128i weighted = _mm_mullo_epi16(rows, _mm_set_epi16(
+        weight_y, weight_y, weight_y, weight_y,
+        256 - weight_y, 256 - weight_y, 256 - weight_y, 256 - weight_y
+    ));
+    __m128i blended = _mm_srli_epi16(_mm_add_epi16(weighted, _mm_srli_si128(weighted, 8)), 8);
+
+    return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(blended, zero));
+#else
+    uint32_t result = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        uint32_t top = (((top_left >> shift) & 0xFF) * (256 - weight_x) + ((top_right >> shift) & 0xFF) * weight_x) >> 8;
+        uint32_t bottom = (((bottom_left >> shift) & 0xFF) * (256 - weight_x) + ((bottom_right >> shift) & 0xFF) * weight_x) >> 8;
+        result |= ((top * (256 - weight_y) + bottom * weight_y) >> 8) << shift;
+    }
+    return result;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Pick the mip level for a whole screen space triangle from its UV derivatives.
+// The ratio of the triangle's area in texels to its area in pixels is the
+// squared texels-per-pixel footprint, so half its log2 is the level where
+// one texel covers roughly one pixel.
+///////////////////////////////////////////////////////////////////////////////
+int texture_select_mip(texture_t *texture, vec4_t points[3], tex2_t texcoords[3])
+{
+    float screen_area = fabsf(
+        (points[1].x - points[0].x) * (points[2].y - points[0].y) -
+        (points[2].x - points[0].x) * (points[1].y - points[0].y)
+    );
+
+    float uv_area = fabsf(
+        (texcoords[1].u - texcoords[0].u) * (texcoords[2].v - texcoords[0].v) -
+        (texcoords[2].u - texcoords[0].u) * (texcoords[1].v - texcoords[0].v)
+    );
+    float texel_area = uv_area * texture->mips[0].width * texture->mips[0].height;
+
+    // Degenerate on screen or in texture space, nothing to minify
+    if (screen_area <= 0.0f || texel_area <= screen_area)
+        return 0;
+
+    int level = (int)(0.5f * log2f(texel_area / screen_area));
+    if (level >= texture->num_mips)
+        level = texture->num_mips - 1;
+
+    return level;
+}
+
+// Drop one reference to the texture, the last one takes it out of the registry and frees it
+void free_texture(texture_t *texture)
+{
+    if (texture == NULL)
+        return;
+
+    texture->ref_count--;
+    if (texture->ref_count > 0)
+        return;
+
+    texture_registry_remove(texture);
+    texture_residency_forget(texture);
+
+    for (int i = 0; i < texture->num_mips; i++)
+    {
+        if (texture_owns_texels(texture, texture->mips[i].texels))
+            free(texture->mips[i].texels);
+    }
+    if (texture->png)
+        upng_free(texture->png);
+    texture_cache_unmap(texture);
+    free(texture->source);
+    free(texture);
+}
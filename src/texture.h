@@ -1,7 +1,33 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <math.h>
 #include "upng.h"
+#include "vector.h"
+
+// Enough levels to take a 32k texture down to 1x1
+#define MAX_NUM_MIPS 16
+
+// Tiled textures store each 4x4 block of texels contiguously (16 texels, 64 bytes, one cache line)
+#define TEXTURE_TILE_SHIFT 2
+#define TEXTURE_TILE_SIZE (1 << TEXTURE_TILE_SHIFT)
+#define TEXTURE_TILE_MASK (TEXTURE_TILE_SIZE - 1)
+
+enum Texture_Layout
+{
+    TEXTURE_LINEAR, // row-major, the way the PNG decodes
+    TEXTURE_TILED,  // row-major 4x4 tiles, row-major texels inside each tile
+    TEXTURE_BC1     // row-major 4x4 tiles, each one compressed to a BC1 block (8 bytes)
+};
+
+// Textures are loaded in this layout. --benchmark-textures shows no win for 4x4 tiling
+// on this rasterizer, so textures stay row-major unless they're compressed
+#define TEXTURE_DEFAULT_LAYOUT TEXTURE_LINEAR
+
+// A BC1 block is two 32-bit words: both RGB565 endpoints, then 2 bits per texel picking a color between them
+#define BC1_BLOCK_WORDS 2
 
 typedef struct
 {
@@ -9,4 +35,185 @@ typedef struct
     float v;
 } tex2_t;
 
-tex2_t tex2_clone(tex2_t *t);
\ No newline at end of file
+enum Texture_Wrap
+{
+    TEXTURE_CLAMP,  // UVs outside 0-1 stretch the edge texels
+    TEXTURE_REPEAT  // UVs outside 0-1 tile the texture
+};
+
+enum Texture_Filter
+{
+    TEXTURE_NEAREST,  // one texel per pixel
+    TEXTURE_BILINEAR  // blend the 2x2 texels around the sample point
+};
+
+// One level of a mip chain, RGBA texels (or BC1 blocks) in the texture's layout
+typedef struct
+{
+    uint32_t *texels;
+    int width;
+    int height;
+    int tiles_x;                // 4x4 tiles per row, partial tiles at the edge are padded
+    enum Texture_Layout layout;
+} mip_level_t;
+
+// A decoded PNG along with its mip chain.
+// Linear mips[0] points straight into the PNG's buffer, every other level halves the one before it
+typedef struct
+{
+    upng_t *png;
+    enum Texture_Layout layout;
+    mip_level_t mips[MAX_NUM_MIPS];
+    int num_mips;
+    int ref_count;  // meshes and batches sharing this texture, free_texture only frees it when the last one lets go
+    void *cache_mapping;  // the memory mapped texture cache file the mips point into, if any
+    size_t cache_size;
+
+    // Textures under the residency budget only keep some of their levels in memory (see texture_residency.c)
+    char *source;           // PNG the levels are loaded from on demand, NULL if the whole chain is always in memory
+    int resident_mip;       // finest level in memory, every coarser one is too. num_mips when none are
+    int wanted_mip;         // finest level sampled this frame
+    unsigned last_visible;  // residency frame the texture was last on screen
+    bool loading;           // levels are being loaded in the background
+    bool managed;           // known to the residency manager
+} texture_t;
+
+// Where texel (x, y) lives in a mip level's buffer, for the uncompressed layouts
+static inline int texel_index(const mip_level_t *mip, int x, int y)
+{
+    if (mip->layout == TEXTURE_LINEAR)
+        return (mip->width * y) + x;
+
+    int tile = ((y >> TEXTURE_TILE_SHIFT) * mip->tiles_x) + (x >> TEXTURE_TILE_SHIFT);
+    return (tile << (2 * TEXTURE_TILE_SHIFT)) + ((y & TEXTURE_TILE_MASK) << TEXTURE_TILE_SHIFT) + (x & TEXTURE_TILE_MASK);
+}
+
+// Widen an RGB565 endpoint to an opaque RGBA texel, replicating the top bits into the bottom ones
+static inline uint32_t bc1_endpoint_to_texel(uint32_t color)
+{
+    uint32_t r = (color >> 11) & 0x1F;
+    uint32_t g = (color >> 5) & 0x3F;
+    uint32_t b = color & 0x1F;
+    r = (r << 3) | (r >> 2);
+    g = (g << 2) | (g >> 4);
+    b = (b << 3) | (b >> 2);
+    return 0xFF000000 | (b << 16) | (g << 8) | r;
+}
+
+// (2 * a + b) / 3 for each channel of two opaque texels
+static inline uint32_t bc1_blend_third(uint32_t a, uint32_t b)
+{
+    uint32_t result = 0xFF000000;
+    for (int shift = 0; shift < 24; shift += 8)
+        result |= ((2 * ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF)) / 3) << shift;
+    return result;
+}
+
+// (a + b) / 2 for each channel of two opaque texels
+static inline uint32_t bc1_blend_half(uint32_t a, uint32_t b)
+{
+    return 0xFF000000 | ((((a & 0xFEFEFE) >> 1) + ((b & 0xFEFEFE) >> 1) + (a & b & 0x010101)) & 0xFFFFFF);
+}
+
+// The color a 2-bit selector picks from a block's endpoints. Like BC1, color0 > color1 means
+// 4 opaque colors, otherwise 3 colors and transparent black
+static inline uint32_t bc1_block_color(uint32_t endpoints, int selector)
+{
+    uint32_t color0 = endpoints & 0xFFFF;
+    uint32_t color1 = endpoints >> 16;
+
+    // Most texels sit on an endpoint, those don't need the other one widened
+    if (selector < 2)
+        return bc1_endpoint_to_texel(selector == 0 ? color0 : color1);
+
+    uint32_t a = bc1_endpoint_to_texel(color0);
+    uint32_t b = bc1_endpoint_to_texel(color1);
+    if (color0 <= color1)
+        return selector == 2 ? bc1_blend_half(a, b) : 0x00000000;
+
+    return selector == 2 ? bc1_blend_third(a, b) : bc1_blend_third(b, a);
+}
+
+// Texel (x, y) of a mip level in any layout, BC1 blocks are decoded on the fly
+static inline uint32_t mip_level_fetch(const mip_level_t *mip, int x, int y)
+{
+    if (mip->layout != TEXTURE_BC1)
+        return mip->texels[texel_index(mip, x, y)];
+
+    int tile = ((y >> TEXTURE_TILE_SHIFT) * mip->tiles_x) + (x >> TEXTURE_TILE_SHIFT);
+    const uint32_t *block = &mip->texels[tile * BC1_BLOCK_WORDS];
+    int selector = (block[1] >> (2 * (((y & TEXTURE_TILE_MASK) << TEXTURE_TILE_SHIFT) + (x & TEXTURE_TILE_MASK)))) & 3;
+    return bc1_block_color(block[0], selector);
+}
+
+// False while none of a managed texture's levels are in memory, nothing can be sampled yet
+static inline bool texture_is_resident(const texture_t *texture)
+{
+    return texture->resident_mip < texture->num_mips;
+}
+
+// Everything needed to fetch texels from one mip level, resolved once per triangle
+// so the per-pixel path never has to look anything up through the texture
+typedef struct
+{
+    mip_level_t mip;
+    int width_mask;         // width - 1 if the width is a power of two, otherwise -1
+    int height_mask;        // height - 1 if the height is a power of two, otherwise -1
+    enum Texture_Wrap wrap;
+    enum Texture_Filter filter;
+} sampler_t;
+
+// Fetch the nearest texel to (u, v), with v already flipped so 0 is the top row
+static inline uint32_t sampler_fetch(const sampler_t *sampler, float u, float v)
+{
+    const mip_level_t *mip = &sampler->mip;
+    int tex_x;
+    int tex_y;
+
+    if (sampler->wrap == TEXTURE_REPEAT)
+    {
+        // floorf, so negative coordinates keep tiling instead of mirroring around 0
+        tex_x = (int)floorf(u * mip->width);
+        tex_y = (int)floorf(v * mip->height);
+
+        // Power of two sizes wrap with a mask, anything else needs a (positive) modulo
+        if (sampler->width_mask >= 0) tex_x &= sampler->width_mask;
+        else tex_x = ((tex_x % mip->width) + mip->width) % mip->width;
+
+        if (sampler->height_mask >= 0) tex_y &= sampler->height_mask;
+        else tex_y = ((tex_y % mip->height) + mip->height) % mip->height;
+    }
+    else
+    {
+        // Scale normalized UVs (0-1 range) up to texture pixel coordinates, then clamp to the edges
+        tex_x = (int)(u * (mip->width - 1));
+        tex_y = (int)(v * (mip->height - 1));
+
+        tex_x = tex_x < 0 ? 0 : (tex_x >= mip->width ? mip->width - 1 : tex_x);
+        tex_y = tex_y < 0 ? 0 : (tex_y >= mip->height ? mip->height - 1 : tex_y);
+    }
+
+    return mip_level_fetch(mip, tex_x, tex_y);
+}
+
+// Where an image's texels are in the texture that holds them, in level 0 texels. An image
+// loaded on its own is the whole texture, one packed into an atlas page a rectangle of the page
+typedef struct
+{
+    int x;
+    int y;
+    int width;
+    int height;
+} texture_region_t;
+
+tex2_t tex2_clone(tex2_t *t);
+
+texture_t* load_texture(const char *png_file);
+void texture_build_mips(texture_t *texture, int max_mips);
+void texture_set_layout(texture_t *texture, enum Texture_Layout layout);
+void texture_set_mip_layout(texture_t *texture, int level, enum Texture_Layout layout);
+size_t mip_level_num_texels(const mip_level_t *mip);
+sampler_t texture_get_sampler(texture_t *texture, int mip_level, enum Texture_Wrap wrap, enum Texture_Filter filter);
+uint32_t sampler_fetch_bilinear(const sampler_t *sampler, float u, float v);
+int texture_select_mip(texture_t *texture, vec4_t points[3], tex2_t texcoords[3]);
+void free_texture(texture_t *texture);
@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "texture_cache.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Raw texture cache
+///////////////////////////////////////////////////////////////////////////////
+// Decoding a PNG means inflating and unfiltering it, then building and tiling
+// its mip chain, every startup. The cache file stores the finished result:
+// every mip level's RGBA32 texels (SDL_PIXELFORMAT_RGBA32 byte order, the
+// same bytes upng decodes to) in the texture's layout, after a small header.
+// Loading it is a single mmap, the mips point straight into the mapping and
+// the pages are only read in as the rasterizer touches them.
+//
+// The header records the PNG's size and modification time. If either one
+// doesn't match the PNG on disk any more the cache is stale, and the PNG is
+// decoded again and a new cache file written.
+///////////////////////////////////////////////////////////////////////////////
+
+#define TEXTURE_CACHE_MAGIC "TEXCACHE"
+
+// Every level starts on a cache line
+#define TEXTURE_CACHE_ALIGNMENT 64
+
+typedef struct
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t tiles_x;
+    uint32_t layout;
+    uint64_t offset;      // from the start of the file
+    uint64_t num_texels;
+} texture_cache_mip_t;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_mips;
+    uint64_t png_size;    // the PNG this cache was built from
+    int64_t png_mtime;
+    texture_cache_mip_t mips[MAX_NUM_MIPS];
+} texture_cache_header_t;
+
+static char* cache_path(const char *png_file)
+{
+    char *path = malloc(strlen(png_file) + sizeof(TEXTURE_CACHE_EXTENSION));
+    strcpy(path, png_file);
+    strcat(path, TEXTURE_CACHE_EXTENSION);
+    return path;
+}
+
+static bool png_file_info(const char *png_file, uint64_t *size, int64_t *mtime)
+{
+    struct stat info;
+    if (stat(png_file, &info) != 0)
+        return false;
+
+    *size = (uint64_t)info.st_size;
+    *mtime = (int64_t)info.st_mtime;
+    return true;
+}
+
+// Map a whole file read-only, returns NULL if it can't be opened
+static void* map_file(const char *path, size_t *size)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL)
+        return NULL;
+
+    // The view keeps the file mapped after the handles are closed
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (data == NULL)
+        return NULL;
+
+    *size = (size_t)file_size.QuadPart;
+    return data;
+#else
+    int file = open(path, O_RDONLY);
+    if (file < 0)
+        return NULL;
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0)
+    {
+        close(file);
+        return NULL;
+    }
+
+    // The mapping stays valid after the file is closed
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED)
+        return NULL;
+
+    *size = (size_t)info.st_size;
+    return data;
+#endif
+}
+
+static void unmap_file(void *data, size_t size)
+{
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+static mip_level_t header_mip(const texture_cache_mip_t *mip)
+{
+    return (mip_level_t){
+        .texels = NULL,
+        .width = mip->width,
+        .height = mip->height,
+        .tiles_x = mip->tiles_x,
+        .layout = (enum Texture_Layout)mip->layout
+    };
+}
+
+// A header is only good for the PNG as it is on disk now, and every level has to fit inside the file
+static bool header_valid(const texture_cache_header_t *header, size_t size, uint64_t png_size, int64_t png_mtime)
+{
+    bool valid = size >= sizeof(texture_cache_header_t) &&
+        memcmp(header->magic, TEXTURE_CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+        header->version == TEXTURE_CACHE_VERSION &&
+        header->png_size == png_size &&
+        header->png_mtime == png_mtime &&
+        header->num_mips >= 1 && header->num_mips <= MAX_NUM_MIPS;
+
+    // Don't trust any level that would reach past the end of the file, or that's short of its size
+    for (uint32_t i = 0; valid && i < header->num_mips; i++)
+    {
+        const texture_cache_mip_t *mip = &header->mips[i];
+        mip_level_t level = header_mip(mip);
+        valid = mip->offset % TEXTURE_CACHE_ALIGNMENT == 0 &&
+            mip->offset <= size &&
+            mip->num_texels <= (size - mip->offset) / sizeof(uint32_t) &&
+            mip->layout <= TEXTURE_BC1 &&
+            mip->num_texels == mip_level_num_texels(&level);
+    }
+
+    return valid;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Map the cache file of a PNG, returns NULL if there isn't one or it's stale
+///////////////////////////////////////////////////////////////////////////////
+texture_t* texture_cache_load(const char *png_file)
+{
+    uint64_t png_size;
+    int64_t png_mtime;
+    if (!png_file_info(png_file, &png_size, &png_mtime))
+        return NULL;
+
+    char *path = cache_path(png_file);
+    size_t size = 0;
+    void *data = map_file(path, &size);
+    free(path);
+    if (data == NULL)
+        return NULL;
+
+    const texture_cache_header_t *header = data;
+    if (!header_valid(header, size, png_size, png_mtime))
+    {
+        unmap_file(data, size);
+        return NULL;
+    }
+
+    texture_t *texture = calloc(1, sizeof(texture_t));
+    texture->png = NULL;
+    texture->layout = (enum Texture_Layout)header->mips[0].layout;
+    texture->num_mips = header->num_mips;
+    texture->ref_count = 1;
+    texture->cache_mapping = data;
+    texture->cache_size = size;
+
+    for (int i = 0; i < texture->num_mips; i++)
+    {
+        const texture_cache_mip_t *mip = &header->mips[i];
+        texture->mips[i] = header_mip(mip);
+        texture->mips[i].texels = (uint32_t*)((char*)data + mip->offset);
+    }
+
+    return texture;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Read levels first to last - 1 of a PNG's cache file into buffers of their
+// own, without mapping or touching the rest of the file. Returns false if
+// there's no fresh cache file or it doesn't have those levels.
+///////////////////////////////////////////////////////////////////////////////
+bool texture_cache_read_mips(const char *png_file, int first, int last, mip_level_t mips[MAX_NUM_MIPS])
+{
+    uint64_t png_size;
+    int64_t png_mtime;
+    if (!png_file_info(png_file, &png_size, &png_mtime))
+        return false;
+
+    char *path = cache_path(png_file);
+    FILE *file = fopen(path, "rb");
+    free(path);
+    if (file == NULL)
+        return false;
+
+    texture_cache_header_t header;
+    bool ok = fseek(file, 0, SEEK_END) == 0;
+    long size = ok ? ftell(file) : -1;
+    ok = size >= 0 && fseek(file, 0, SEEK_SET) == 0 &&
+        fread(&header, sizeof(header), 1, file) == 1 &&
+        header_valid(&header, (size_t)size, png_size, png_mtime) &&
+        first >= 0 && first <= last && last <= (int)header.num_mips;
+
+    int num_read = 0;
+    for (int level = first; ok && level < last; level++)
+    {
+        const texture_cache_mip_t *mip = &header.mips[level];
+        mips[level] = header_mip(mip);
+        mips[level].texels = malloc(mip->num_texels * sizeof(uint32_t));
+        num_read++;
+        ok = fseek(file, (long)mip->offset, SEEK_SET) == 0 &&
+            fread(mips[level].texels, sizeof(uint32_t), mip->num_texels, file) == mip->num_texels;
+    }
+
+    // Don't hand back half of the levels
+    if (!ok)
+    {
+        for (int i = first; i < first + num_read; i++)
+        {
+            free(mips[i].texels);
+            mips[i].texels = NULL;
+        }
+    }
+
+    fclose(file);
+    return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Write a freshly decoded texture's cache file. It's written under a
+// temporary name and renamed into place, so a reader never maps half a file.
+// Failing to write it (e.g. read-only assets) only costs the next startup time.
+///////////////////////////////////////////////////////////////////////////////
+void texture_cache_save(const texture_t *texture, const char *png_file)
+{
+    // Only RGBA8 is what the rasterizer samples, anything else isn't worth caching
+    if (texture->png == NULL || upng_get_format(texture->png) != UPNG_RGBA8)
+        return;
+
+    texture_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = TEXTURE_CACHE_VERSION;
+    header.num_mips = texture->num_mips;
+    if (!png_file_info(png_file, &header.png_size, &header.png_mtime))
+        return;
+
+    uint64_t offset = (sizeof(header) + TEXTURE_CACHE_ALIGNMENT - 1) / TEXTURE_CACHE_ALIGNMENT * TEXTURE_CACHE_ALIGNMENT;
+    for (int i = 0; i < texture->num_mips; i++)
+    {
+        const mip_level_t *mip = &texture->mips[i];
+        header.mips[i] = (texture_cache_mip_t){
+            .width = mip->width,
+            .height = mip->height,
+            .tiles_x = mip->tiles_x,
+            .layout = mip->layout,
+            .offset = offset,
+            .num_texels = mip_level_num_texels(mip)
+        };
+        offset += header.mips[i].num_texels * sizeof(uint32_t);
+        offset = (offset + TEXTURE_CACHE_ALIGNMENT - 1) / TEXTURE_CACHE_ALIGNMENT * TEXTURE_CACHE_ALIGNMENT;
+    }
+
+    char *path = cache_path(png_file);
+    char *temp_path = malloc(strlen(path) + 5);
+    strcpy(temp_path, path);
+    strcat(temp_path, ".tmp");
+
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL)
+    {
+        free(temp_path);
+        free(path);
+        return;
+    }
+
+    static const char padding[TEXTURE_CACHE_ALIGNMENT] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t written = sizeof(header);
+    for (int i = 0; ok && i < texture->num_mips; i++)
+    {
+        ok = fwrite(padding, 1, header.mips[i].offset - written, file) == header.mips[i].offset - written &&
+            fwrite(texture->mips[i].texels, sizeof(uint32_t), header.mips[i].num_texels, file) == header.mips[i].num_texels;
+        written = header.mips[i].offset + header.mips[i].num_texels * sizeof(uint32_t);
+    }
+    ok = (fclose(file) == 0) && ok;
+
+    // rename won't replace an existing file on Windows
+    if (ok)
+    {
+        remove(path);
+        ok = rename(temp_path, path) == 0;
+    }
+    if (!ok)
+        remove(temp_path);
+
+    free(temp_path);
+    free(path);
+}
+
+void texture_cache_unmap(texture_t *texture)
+{
+    if (texture->cache_mapping)
+    {
+        unmap_file(texture->cache_mapping, texture->cache_size);
+        texture->cache_mapping = NULL;
+        texture->cache_size = 0;
+    }
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "texture.h"
+
+// The cache file sits next to its PNG, e.g. ./assets/f22.png.texcache
+#define TEXTURE_CACHE_EXTENSION ".texcache"
+
+// Bump whenever the file layout or the way textures are built changes, so old cache files count as stale
+#define TEXTURE_CACHE_VERSION 2
+
+texture_t* texture_cache_load(const char *png_file);
+void texture_cache_save(const texture_t *texture, const char *png_file);
+void texture_cache_unmap(texture_t *texture);
+bool texture_cache_read_mips(const char *png_file, int first, int last, mip_level_t mips[MAX_NUM_MIPS]);
@@ -0,0 +1,227 @@
+// realpath() is POSIX, and -std=c99 hides it unless we ask for it. Allocating the result
+// (a NULL buffer) is POSIX.1-2008, which glibc, musl, the BSDs and macOS 10.6+ all have
+#if !defined(_WIN32) && !defined(_XOPEN_SOURCE)
+#define _XOPEN_SOURCE 700
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "texture_registry.h"
+#include "texture_residency.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Shared textures
+///////////////////////////////////////////////////////////////////////////////
+// Every texture that was loaded from a file is registered under its canonical
+// path and a hash of the file's contents. Asking for the same file again, by
+// any relative path, hands back the texture that's already loaded with one
+// more reference, and so does asking for a different file with identical
+// contents. Fifty instances of an aircraft decode and hold its PNG once.
+//
+// free_texture() drops a reference, and the last one takes the texture out of
+// the registry before freeing it, so the registry never holds a reference of
+// its own. It's not thread safe, workers only hash and decode, and whatever
+// they produce is looked up and registered from the main thread.
+//
+// Once a texture is packed into an atlas page, its paths stay registered to
+// the page along with the texture's rectangle on it. Asking for the PNG again
+// hands back the page, and the caller maps its UVs into the rectangle.
+///////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+    char *path;         // canonical path of the PNG
+    uint64_t hash;      // FNV-1a of the file's contents
+    uint64_t size;      // size of the file in bytes
+    texture_t *texture;
+    texture_region_t region;  // where the PNG's texels are in the texture
+} texture_entry_t;
+
+static texture_entry_t textures[MAX_NUM_TEXTURES];
+static int texture_count = 0;
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define HASH_CHUNK_SIZE (64 * 1024)
+
+// Absolute path with the . and .. parts resolved, or a copy of the path if the file can't be found
+char* texture_canonical_path(const char *png_file)
+{
+#ifdef _WIN32
+    char *path = _fullpath(NULL, png_file, 0);
+#else
+    char *path = realpath(png_file, NULL);
+#endif
+    if (path != NULL)
+        return path;
+
+    path = malloc(strlen(png_file) + 1);
+    strcpy(path, png_file);
+    return path;
+}
+
+// Hash a whole file, false if it can't be read
+bool texture_hash_file(const char *path, uint64_t *hash, uint64_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+
+    unsigned char *chunk = malloc(HASH_CHUNK_SIZE);
+    *hash = FNV_OFFSET_BASIS;
+    *size = 0;
+
+    size_t length;
+    while ((length = fread(chunk, 1, HASH_CHUNK_SIZE, file)) > 0)
+    {
+        for (size_t i = 0; i < length; i++)
+        {
+            *hash ^= chunk[i];
+            *hash *= FNV_PRIME;
+        }
+        *size += length;
+    }
+
+    bool ok = !ferror(file);
+    free(chunk);
+    fclose(file);
+    return ok;
+}
+
+static void add_entry(const char *canonical_path, uint64_t hash, uint64_t size, texture_t *texture, texture_region_t region)
+{
+    if (texture_count >= MAX_NUM_TEXTURES)
+        return;
+
+    texture_entry_t *entry = &textures[texture_count++];
+    entry->path = malloc(strlen(canonical_path) + 1);
+    strcpy(entry->path, canonical_path);
+    entry->hash = hash;
+    entry->size = size;
+    entry->texture = texture;
+    entry->region = region;
+}
+
+// The texture registered under a canonical path with a new reference, or NULL
+texture_t* texture_registry_find_path(const char *canonical_path, texture_region_t *region)
+{
+    for (int i = 0; i < texture_count; i++)
+    {
+        if (strcmp(textures[i].path, canonical_path) == 0)
+        {
+            textures[i].texture->ref_count++;
+            *region = textures[i].region;
+            return textures[i].texture;
+        }
+    }
+    return NULL;
+}
+
+// A texture loaded from identical contents with a new reference, or NULL.
+// The path is registered for it too, so next time the path alone finds it
+texture_t* texture_registry_find_content(const char *canonical_path, uint64_t hash, uint64_t size, texture_region_t *region)
+{
+    for (int i = 0; i < texture_count; i++)
+    {
+        if (textures[i].hash == hash && textures[i].size == size)
+        {
+            texture_t *texture = textures[i].texture;
+            *region = textures[i].region;
+            add_entry(canonical_path, hash, size, texture, *region);
+            texture->ref_count++;
+            return texture;
+        }
+    }
+    return NULL;
+}
+
+// Register a texture under a path, a full registry only means the texture isn't shared
+void texture_registry_add(const char *canonical_path, uint64_t hash, uint64_t size, texture_t *texture)
+{
+    add_entry(canonical_path, hash, size, texture, (texture_region_t){0, 0, texture->mips[0].width, texture->mips[0].height});
+}
+
+// The texture was copied into an atlas page with its top left texel at (x, y), its paths now lead there
+void texture_registry_move_to_page(const texture_t *texture, texture_t *page, int x, int y)
+{
+    for (int i = 0; i < texture_count; i++)
+    {
+        if (textures[i].texture == texture)
+        {
+            textures[i].texture = page;
+            textures[i].region.x += x;
+            textures[i].region.y += y;
+        }
+    }
+}
+
+// Forget every path of a texture that's being freed
+void texture_registry_remove(const texture_t *texture)
+{
+    int i = 0;
+    while (i < texture_count)
+    {
+        if (textures[i].texture == texture)
+        {
+            free(textures[i].path);
+            textures[i] = textures[--texture_count];
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Get a shared texture for a PNG, loading it only if neither its path nor its
+// contents are loaded yet. Returns NULL if it can't be read, otherwise the
+// caller owns one reference and lets go of it with free_texture(). The region
+// is where the PNG's texels are, a rectangle of an atlas page if it's been
+// packed into one.
+///////////////////////////////////////////////////////////////////////////////
+texture_t* acquire_texture(const char *png_file, texture_region_t *region)
+{
+    char *path = texture_canonical_path(png_file);
+
+    texture_t *texture = texture_registry_find_path(path, region);
+    if (texture == NULL)
+    {
+        uint64_t hash, size;
+        if (texture_hash_file(path, &hash, &size))
+        {
+            texture = texture_registry_find_content(path, hash, size, region);
+            if (texture == NULL)
+            {
+                texture = texture_residency_load(png_file);
+                if (texture != NULL)
+                {
+                    texture_registry_add(path, hash, size, texture);
+                    *region = (texture_region_t){0, 0, texture->mips[0].width, texture->mips[0].height};
+                }
+            }
+        }
+    }
+
+    free(path);
+    return texture;
+}
+
+void get_texture_info(void)
+{
+    printf("============ TEXTURE INFO ============\n");
+    for (int i = 0; i < texture_count; i++)
+    {
+        const texture_t *texture = textures[i].texture;
+        const texture_region_t *region = &textures[i].region;
+        if (region->width == texture->mips[0].width && region->height == texture->mips[0].height)
+            printf("%s: %dx%d, %d mips, %d references\n",
+                   textures[i].path, texture->mips[0].width, texture->mips[0].height, texture->num_mips, texture->ref_count);
+        else
+            printf("%s: %dx%d at (%d, %d) of a %dx%d atlas page, %d mips, %d references\n",
+                   textures[i].path, region->width, region->height, region->x, region->y,
+                   texture->mips[0].width, texture->mips[0].height, texture->num_mips, texture->ref_count);
+    }
+    printf("======================================");
+}
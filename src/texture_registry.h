@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "texture.h"
+
+// Paths registered at once, several paths to the same file or to identical files count once each
+#define MAX_NUM_TEXTURES 64
+
+texture_t* acquire_texture(const char *png_file, texture_region_t *region);
+
+char* texture_canonical_path(const char *png_file);
+bool texture_hash_file(const char *path, uint64_t *hash, uint64_t *size);
+texture_t* texture_registry_find_path(const char *canonical_path, texture_region_t *region);
+texture_t* texture_registry_find_content(const char *canonical_path, uint64_t hash, uint64_t size, texture_region_t *region);
+void texture_registry_add(const char *canonical_path, uint64_t hash, uint64_t size, texture_t *texture);
+void texture_registry_move_to_page(const texture_t *texture, texture_t *page, int x, int y);
+void texture_registry_remove(const texture_t *texture);
+void get_texture_info(void);
@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "texture_residency.h"
+#include "texture_cache.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Texture residency
+///////////////////////////////////////////////////////////////////////////////
+// With a budget set, loading a scene only reads each PNG's header. A texture
+// is created with its full mip chain described but none of its levels in
+// memory, and is drawn flat shaded until some are.
+//
+// Every frame the meshes that pass the frustum cull mark their textures as
+// visible, and every textured triangle notes the finest level it samples.
+// At the start of the next frame each visible texture that's missing levels
+// gets a background load, the first one only of the small levels, so
+// something shows up right away and the rest follow. When the budget runs
+// out, the textures that have gone longest without being on screen are
+// evicted whole, and after them the levels of visible textures that are
+// finer than anything on screen samples.
+//
+// Levels come out of the texture's cache file one at a time. A texture
+// without a fresh cache file is decoded once to build it.
+///////////////////////////////////////////////////////////////////////////////
+
+texture_residency_t texture_residency;
+
+static texture_t *textures[MAX_NUM_RESIDENT_TEXTURES];
+static int texture_count = 0;
+
+// Levels first to last - 1 of one texture, loaded on the worker thread
+typedef struct
+{
+    texture_t *texture;              // holds a reference until the load is applied
+    const char *source;
+    int first;
+    int last;
+    size_t bytes;
+    mip_level_t expected[MAX_NUM_MIPS];  // the texture's level sizes, the worker never reads the texture itself
+    mip_level_t mips[MAX_NUM_MIPS];
+    texture_t *decoded;              // the full decode when there was no cache file, freed on the main thread
+    bool ok;
+} residency_load_t;
+
+// Each texture has at most one load in flight
+static residency_load_t *queue[MAX_NUM_RESIDENT_TEXTURES];
+static int queue_head = 0;
+static int queue_count = 0;
+static residency_load_t *finished[MAX_NUM_RESIDENT_TEXTURES];
+static int finished_count = 0;
+
+static SDL_mutex *mutex = NULL;
+static SDL_cond *work_available = NULL;
+static SDL_Thread *worker = NULL;
+static bool quit = false;
+
+static size_t level_bytes(const mip_level_t *mip)
+{
+    return mip_level_num_texels(mip) * sizeof(uint32_t);
+}
+
+// Read the levels from the cache file, or decode the PNG if there isn't a good one
+static void load_levels(residency_load_t *load)
+{
+    load->ok = texture_cache_read_mips(load->source, load->first, load->last, load->mips);
+    for (int i = load->first; load->ok && i < load->last; i++)
+    {
+        load->ok = load->mips[i].width == load->expected[i].width && load->mips[i].height == load->expected[i].height;
+    }
+    if (load->ok)
+        return;
+
+    for (int i = load->first; i < load->last; i++)
+    {
+        free(load->mips[i].texels);
+        load->mips[i].texels = NULL;
+    }
+
+    // Decoding writes a fresh cache file, so it only happens once per PNG
+    load->decoded = load_texture(load->source);
+    load->ok = load->decoded != NULL && load->decoded->num_mips > load->last - 1;
+    for (int i = load->first; load->ok && i < load->last; i++)
+    {
+        const mip_level_t *mip = &load->decoded->mips[i];
+        load->mips[i] = *mip;
+        load->mips[i].texels = malloc(level_bytes(mip));
+        memcpy(load->mips[i].texels, mip->texels, level_bytes(mip));
+    }
+}
+
+static int residency_worker(void *data)
+{
+    SDL_LockMutex(mutex);
+    for (;;)
+    {
+        while (queue_count == 0 && !quit)
+            SDL_CondWait(work_available, mutex);
+        if (quit)
+            break;
+
+        residency_load_t *load = queue[queue_head];
+        queue_head = (queue_head + 1) % MAX_NUM_RESIDENT_TEXTURES;
+        queue_count--;
+        SDL_UnlockMutex(mutex);
+
+        load_levels(load);
+
+        SDL_LockMutex(mutex);
+        finished[finished_count++] = load;
+    }
+    SDL_UnlockMutex(mutex);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Set the texel budget in bytes. Call it before any textures are loaded,
+// with 0 textures load whole and nothing is ever evicted.
+///////////////////////////////////////////////////////////////////////////////
+void texture_residency_init(size_t budget)
+{
+    texture_residency = (texture_residency_t){.budget = budget};
+    if (budget == 0)
+        return;
+
+    mutex = SDL_CreateMutex();
+    work_available = SDL_CreateCond();
+    quit = false;
+    worker = SDL_CreateThread(residency_worker, "residency", NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Load a texture the residency manager decides the levels of. Only the PNG's
+// header is read, the level sizes follow from it the same way
+// texture_build_mips halves them. Safe to call from the loader's threads.
+///////////////////////////////////////////////////////////////////////////////
+texture_t* texture_residency_load(const char *png_file)
+{
+    if (texture_residency.budget == 0)
+        return load_texture(png_file);
+
+    upng_t *png_image = upng_new_from_file(png_file);
+    if (png_image == NULL)
+        return NULL;
+
+    upng_header(png_image);
+    if (upng_get_error(png_image) != UPNG_EOK)
+    {
+        upng_free(png_image);
+        return NULL;
+    }
+
+    texture_t *texture = calloc(1, sizeof(texture_t));
+    texture->png = NULL;
+    texture->layout = TEXTURE_DEFAULT_LAYOUT;
+    texture->ref_count = 1;
+    texture->mips[0] = (mip_level_t){
+        .texels = NULL,
+        .width = upng_get_width(png_image),
+        .height = upng_get_height(png_image),
+        .layout = TEXTURE_DEFAULT_LAYOUT
+    };
+    upng_free(png_image);
+
+    texture->num_mips = 1;
+    while (texture->num_mips < MAX_NUM_MIPS)
+    {
+        const mip_level_t *src = &texture->mips[texture->num_mips - 1];
+        if (src->width == 1 && src->height == 1)
+            break;
+
+        mip_level_t *dst = &texture->mips[texture->num_mips++];
+        dst->texels = NULL;
+        dst->width = src->width > 1 ? src->width / 2 : 1;
+        dst->height = src->height > 1 ? src->height / 2 : 1;
+        dst->layout = TEXTURE_DEFAULT_LAYOUT;
+    }
+    for (int i = 0; i < texture->num_mips; i++)
+    {
+        texture->mips[i].tiles_x = (texture->mips[i].width + TEXTURE_TILE_MASK) >> TEXTURE_TILE_SHIFT;
+    }
+
+    texture->source = malloc(strlen(png_file) + 1);
+    strcpy(texture->source, png_file);
+    texture->resident_mip = texture->num_mips;
+    texture->wanted_mip = texture->num_mips;
+
+    return texture;
+}
+
+// A mesh using the texture passed the frustum cull this frame
+void texture_residency_touch(texture_t *texture)
+{
+    if (texture == NULL || texture->source == NULL)
+        return;
+
+    if (!texture->managed)
+    {
+        if (texture_count >= MAX_NUM_RESIDENT_TEXTURES)
+            return;
+        textures[texture_count++] = texture;
+        texture->managed = true;
+    }
+
+    texture->last_visible = texture_residency.frame;
+}
+
+// A triangle samples the texture at this level this frame
+void texture_residency_want(texture_t *texture, int mip_level)
+{
+    if (mip_level < texture->wanted_mip)
+        texture->wanted_mip = mip_level;
+}
+
+// Free the finest level in memory
+static void evict_level(texture_t *texture)
+{
+    mip_level_t *mip = &texture->mips[texture->resident_mip];
+    texture_residency.resident_bytes -= level_bytes(mip);
+    free(mip->texels);
+    mip->texels = NULL;
+    texture->resident_mip++;
+    texture_residency.num_evictions++;
+}
+
+static bool visible_last_frame(const texture_t *texture)
+{
+    return texture->last_visible == texture_residency.frame;
+}
+
+// Evict until needed more bytes fit in the budget, returns false if they can't
+static bool make_room(size_t needed)
+{
+    while (texture_residency.resident_bytes + texture_residency.pending_bytes + needed > texture_residency.budget)
+    {
+        // The texture that's been off screen the longest goes whole
+        texture_t *victim = NULL;
+        for (int i = 0; i < texture_count; i++)
+        {
+            texture_t *texture = textures[i];
+            if (texture->loading || !texture_is_resident(texture) || visible_last_frame(texture))
+                continue;
+            if (victim == NULL || texture->last_visible < victim->last_visible)
+                victim = texture;
+        }
+        if (victim)
+        {
+            while (texture_is_resident(victim))
+                evict_level(victim);
+            continue;
+        }
+
+        // Everything left is on screen, drop the biggest level finer than what's sampled
+        for (int i = 0; i < texture_count; i++)
+        {
+            texture_t *texture = textures[i];
+            if (texture->loading || texture->resident_mip >= texture->wanted_mip || texture->resident_mip >= texture->num_mips - 1)
+                continue;
+            if (victim == NULL || level_bytes(&texture->mips[texture->resident_mip]) > level_bytes(&victim->mips[victim->resident_mip]))
+                victim = texture;
+        }
+        if (victim == NULL)
+            return false;
+        evict_level(victim);
+    }
+    return true;
+}
+
+// Move the levels of a finished load into its texture
+static void apply_load(residency_load_t *load)
+{
+    texture_t *texture = load->texture;
+    texture->loading = false;
+    texture_residency.pending_bytes -= load->bytes;
+
+    if (load->ok)
+    {
+        for (int i = load->first; i < load->last; i++)
+        {
+            texture->mips[i] = load->mips[i];
+            texture_residency.resident_bytes += level_bytes(&texture->mips[i]);
+
+            // The layout may have changed while it was loading, converting it keeps resident_bytes up to date
+            texture_set_mip_layout(texture, i, texture->layout);
+        }
+        texture->resident_mip = load->first;
+        texture_residency.num_loads += load->last - load->first;
+    }
+
+    free_texture(load->decoded);
+    free_texture(texture);
+    free(load);
+}
+
+static void queue_load(texture_t *texture, int first, size_t bytes)
+{
+    residency_load_t *load = calloc(1, sizeof(residency_load_t));
+    load->texture = texture;
+    load->source = texture->source;
+    load->first = first;
+    load->last = texture->resident_mip;
+    load->bytes = bytes;
+    memcpy(load->expected, texture->mips, sizeof(load->expected));
+
+    texture->ref_count++;
+    texture->loading = true;
+    texture_residency.pending_bytes += bytes;
+
+    SDL_LockMutex(mutex);
+    queue[(queue_head + queue_count) % MAX_NUM_RESIDENT_TEXTURES] = load;
+    queue_count++;
+    SDL_CondSignal(work_available);
+    SDL_UnlockMutex(mutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Once per frame, before any mesh is processed: take in the finished loads,
+// start loads for what was on screen last frame, evicting to make room, then
+// start a new frame of visibility.
+///////////////////////////////////////////////////////////////////////////////
+void texture_residency_update(void)
+{
+    if (texture_residency.budget == 0)
+        return;
+
+    SDL_LockMutex(mutex);
+    residency_load_t *loads[MAX_NUM_RESIDENT_TEXTURES];
+    int num_loads = finished_count;
+    memcpy(loads, finished, num_loads * sizeof(residency_load_t*));
+    finished_count = 0;
+    SDL_UnlockMutex(mutex);
+
+    for (int i = 0; i < num_loads; i++)
+    {
+        apply_load(loads[i]);
+    }
+
+    for (int i = 0; i < texture_count; i++)
+    {
+        texture_t *texture = textures[i];
+        if (texture->loading || !visible_last_frame(texture) || texture->wanted_mip >= texture->num_mips)
+            continue;
+        if (texture->resident_mip <= texture->wanted_mip)
+            continue;
+
+        // Start small, the finer levels come with the next load
+        int first = texture->wanted_mip;
+        if (!texture_is_resident(texture))
+        {
+            int small = 0;
+            while (texture->mips[small].width > RESIDENCY_FIRST_MIP_SIZE || texture->mips[small].height > RESIDENCY_FIRST_MIP_SIZE)
+                small++;
+            first = first > small ? first : small;
+        }
+
+        // Settle for coarser levels if the finer ones don't fit
+        size_t bytes = 0;
+        for (int level = first; level < texture->resident_mip; level++)
+            bytes += level_bytes(&texture->mips[level]);
+        while (first < texture->resident_mip && !make_room(bytes))
+        {
+            bytes -= level_bytes(&texture->mips[first]);
+            first++;
+        }
+
+        if (first < texture->resident_mip)
+            queue_load(texture, first, bytes);
+    }
+
+    texture_residency.frame++;
+    for (int i = 0; i < texture_count; i++)
+    {
+        textures[i]->wanted_mip = textures[i]->num_mips;
+    }
+}
+
+// A resident level of a managed texture was converted to another layout, which changed its size
+void texture_residency_resize_level(size_t old_bytes, size_t new_bytes)
+{
+    texture_residency.resident_bytes -= old_bytes;
+    texture_residency.resident_bytes += new_bytes;
+}
+
+// The texture is being freed, stop tracking it
+void texture_residency_forget(texture_t *texture)
+{
+    if (!texture->managed)
+        return;
+
+    for (int i = 0; i < texture_count; i++)
+    {
+        if (textures[i] == texture)
+        {
+            for (int level = texture->resident_mip; level < texture->num_mips; level++)
+                texture_residency.resident_bytes -= level_bytes(&texture->mips[level]);
+            textures[i] = textures[--texture_count];
+            break;
+        }
+    }
+    texture->managed = false;
+}
+
+// Stop the worker and drop the loads it didn't get to
+void texture_residency_shutdown(void)
+{
+    if (worker == NULL)
+        return;
+
+    SDL_LockMutex(mutex);
+    quit = true;
+    SDL_CondSignal(work_available);
+    SDL_UnlockMutex(mutex);
+    SDL_WaitThread(worker, NULL);
+    worker = NULL;
+
+    while (queue_count > 0)
+    {
+        residency_load_t *load = queue[queue_head];
+        queue_head = (queue_head + 1) % MAX_NUM_RESIDENT_TEXTURES;
+        queue_count--;
+        load->ok = false;
+        apply_load(load);
+    }
+    while (finished_count > 0)
+    {
+        apply_load(finished[--finished_count]);
+    }
+
+    SDL_DestroyCond(work_available);
+    SDL_DestroyMutex(mutex);
+}
+
+void get_residency_info(void)
+{
+    printf("=========== RESIDENCY INFO ===========\n");
+    printf("Budget: %.1fMB\n", texture_residency.budget / (1024.0f * 1024.0f));
+    printf("Resident: %.1fMB\n", texture_residency.resident_bytes / (1024.0f * 1024.0f));
+    printf("Levels loaded: %d, evicted: %d\n", texture_residency.num_loads, texture_residency.num_evictions);
+    for (int i = 0; i < texture_count; i++)
+    {
+        const texture_t *texture = textures[i];
+        if (texture_is_resident(texture))
+            printf("%s: from level %d (%dx%d)\n", texture->source, texture->resident_mip,
+                   texture->mips[texture->resident_mip].width, texture->mips[texture->resident_mip].height);
+        else
+            printf("%s: not resident\n", texture->source);
+    }
+    printf("======================================");
+}
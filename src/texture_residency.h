@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "texture.h"
+
+// Textures the residency manager can keep track of at once
+#define MAX_NUM_RESIDENT_TEXTURES 256
+
+// The first time a texture is on screen only the levels up to this size are loaded,
+// the finer ones follow in later frames
+#define RESIDENCY_FIRST_MIP_SIZE 64
+
+typedef struct
+{
+    size_t budget;          // bytes of texels kept in memory, 0 loads every texture whole up front
+    size_t resident_bytes;  // bytes of texels in memory
+    size_t pending_bytes;   // bytes of the loads still running in the background
+    unsigned frame;         // counts texture_residency_update calls
+    int num_loads;          // levels loaded since startup
+    int num_evictions;      // levels evicted since startup
+} texture_residency_t;
+
+extern texture_residency_t texture_residency;
+
+void texture_residency_init(size_t budget);
+texture_t* texture_residency_load(const char *png_file);
+void texture_residency_touch(texture_t *texture);
+void texture_residency_want(texture_t *texture, int mip_level);
+void texture_residency_update(void);
+void texture_residency_resize_level(size_t old_bytes, size_t new_bytes);
+void texture_residency_forget(texture_t *texture);
+void texture_residency_shutdown(void);
+void get_residency_info(void);
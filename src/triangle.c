@@ -39,6 +39,7 @@ void draw_triangle_pixel(
     )
 {
     if (x < 0 || x >= w->width || y < 0 || y >= w->height) return;
+    window_touch_pixel(w, x, y);
 
     vec2_t p = {x, y};
     vec2_t a = vec2_from_vec4(point_a);
@@ -179,14 +180,21 @@ vec3_t barycentric_weights(vec2_t a, vec2_t b, vec2_t c, vec2_t p)
     return (vec3_t){alpha, beta, gamma};
 }
 
-void draw_texel(
+///////////////////////////////////////////////////////////////////////////////
+// Find the perspective correct UV and the depth of the pixel at (x, y), the
+// part of drawing a texel that doesn't depend on the filter. Returns false if
+// the pixel is off the screen or behind what's already in the z-buffer.
+///////////////////////////////////////////////////////////////////////////////
+static inline bool interpolate_texel(
         Window *w,
-        int x, int y, upng_t *texture,
+        int x, int y,
         vec4_t point_a, vec4_t point_b, vec4_t point_c,
-        tex2_t a_uv, tex2_t b_uv, tex2_t c_uv
+        tex2_t a_uv, tex2_t b_uv, tex2_t c_uv,
+        float *u, float *v, float *depth
      )
 {
-    if (x < 0 || x >= w->width || y < 0 || y >= w->height) return;
+    if (x < 0 || x >= w->width || y < 0 || y >= w->height) return false;
+    window_touch_pixel(w, x, y);
 
     vec2_t p = {x, y};
     // We don't need to pass in z and w to caluclate the Barycentric coordinates
@@ -223,38 +231,189 @@ void draw_texel(
     // we have to flip V, by doing 1.0 - V
     interpolated_v = 1.0f - interpolated_v;
 
-    // Get the texture's width and height
-    int tex_width = upng_get_width(texture);
-    int tex_height = upng_get_height(texture);
+    // Adjust 1/w, so that pixels that are closer to the camera have a smaller value
+    interpolated_reciprocal_w = 1.0f - interpolated_reciprocal_w;
 
-    // Scale normalized UVs (0–1 range) up to texture pixel coordinates
-    int tex_x = (int)(interpolated_u * (tex_width  - 1));
-    int tex_y = (int)(interpolated_v * (tex_height - 1));
+    *u = interpolated_u;
+    *v = interpolated_v;
+    *depth = interpolated_reciprocal_w;
 
-    // Ensure tex_x and tex_y are in the range [0, texture_width/height - 1]
-    if (tex_x < 0) tex_x = 0;
-    else if (tex_x >= tex_width) tex_x = tex_width - 1;
+    // Only draw the pixel if the depth value is les then the one previously stored in the z-buffer
+    return interpolated_reciprocal_w < w->z_buffer[(w->width * y) + x];
+}
 
-    if (tex_y < 0) tex_y = 0;
-    else if (tex_y >= tex_height) tex_y = tex_height - 1;
+void draw_texel(
+        Window *w,
+        int x, int y, sampler_t *sampler,
+        vec4_t point_a, vec4_t point_b, vec4_t point_c,
+        tex2_t a_uv, tex2_t b_uv, tex2_t c_uv
+     )
+{
+    float u, v, depth;
+    if (!interpolate_texel(w, x, y, point_a, point_b, point_c, a_uv, b_uv, c_uv, &u, &v, &depth))
+        return;
+
+    // Draw the correct color from the texture, wrapped or clamped by the sampler
+    draw_pixel(w, x, y, sampler_fetch(sampler, u, v));
+    // Update the z-buffer with the 1/w of the current pixel
+    w->z_buffer[(w->width * y) + x] = depth;
+}
 
+// Same as draw_texel, but blend the 2x2 texels around the sample
+void draw_texel_bilinear(
+        Window *w,
+        int x, int y, sampler_t *sampler,
+        vec4_t point_a, vec4_t point_b, vec4_t point_c,
+        tex2_t a_uv, tex2_t b_uv, tex2_t c_uv
+     )
+{
+    float u, v, depth;
+    if (!interpolate_texel(w, x, y, point_a, point_b, point_c, a_uv, b_uv, c_uv, &u, &v, &depth))
+        return;
 
-    // Adjust 1/w, so that pixels that are closer to the camera have a smaller value
-    interpolated_reciprocal_w = 1.0f - interpolated_reciprocal_w;
+    draw_pixel(w, x, y, sampler_fetch_bilinear(sampler, u, v));
+    w->z_buffer[(w->width * y) + x] = depth;
+}
 
-    // Only draw the pixel if the depth value is les then the one previously stored in the z-buffer
-    if (interpolated_reciprocal_w < w->z_buffer[(w->width * y) + x])
+// Walk both halves of a triangle sorted by y and draw its texels with nearest filtering
+static void draw_textured_spans(
+        Window *w,
+        sampler_t *sampler,
+        int x0, int y0, int x1, int y1, int x2, int y2,
+        vec4_t point_a, vec4_t point_b, vec4_t point_c,
+        tex2_t a_uv, tex2_t b_uv, tex2_t c_uv
+    )
+{
+    ///////////////////////////////////////////////////////
+    // Render the upper part of the triangle (flat-bottom)
+    ///////////////////////////////////////////////////////
+
+    float inv_slope_1 = (float)(x1 - x0) / (y1 - y0);
+    float inv_slope_2 = (float)(x2 - x0) / (y2 - y0);
+
+    // Only draw the top (flat-bottom) half if it has vertical height.
+    // If y1 == y0, the triangle is actually flat-top and there is no top half to render.
+    if (y0 != y1)
     {
-        // Get the buffer of colros from the texture
-        uint32_t *tex_buffer = (uint32_t*)upng_get_buffer(texture);
+        // Render the flat-bottom triangle
+        for (int y = y0; y <= y1; y++)
+        {   
+            float x_start = x1 + (y - y1) * inv_slope_1;
+            float x_end = x0 + (y - y0) * inv_slope_2;
 
-        // Draw the correct color from the texture
-        draw_pixel(w, x, y, tex_buffer[(tex_width * tex_y) + tex_x]);
-        // Update the z-buffer with the 1/w of the current pixel
-        w->z_buffer[(w->width * y) + x] = interpolated_reciprocal_w;
+            // Swap if x_start is to the right of x_end
+            if (x_end < x_start) float_swap(&x_start, &x_end);
+
+            for (int x = x_start; x <= x_end; x++)
+            {
+                // Draw the pixel that comes from the texture
+                draw_texel(w, x, y, sampler, point_a, point_b, point_c, a_uv, b_uv, c_uv);
+            }
+        }
+    }
+
+    ///////////////////////////////////////////////////////
+    // Render the bottom part of the triangle (flat-top)
+    ///////////////////////////////////////////////////////
+
+    inv_slope_1 = (float)(x2 - x1) / (y2 - y1);
+    inv_slope_2 = (float)(x2 - x0) / (y2 - y0);
+
+    // Only draw the bottom (flat-yop) half if it has vertical height.
+    // If y1 == y2, the triangle is actually flat-bottom and there is no bottom half to render.
+    if (y1  != y2)
+    {
+        // Render the flat-top triangle
+        for (int y = y1; y <= y2; y++)
+        {
+            // Find the new x_start and x_end for the scanline
+            float x_start = x1 + (y - y1) * inv_slope_1;
+            float x_end = x0 + (y - y0) * inv_slope_2;
+
+            // Swap if x_start is to the right of x_end
+            // This can occur if the object is rotated
+            if (x_end < x_start) float_swap(&x_start, &x_end);
+
+            for (int x = x_start; x <= x_end; x++)
+            {
+                // Draw the pixel that comes from the texture
+                draw_texel(w, x, y, sampler, point_a, point_b, point_c, a_uv, b_uv, c_uv);
+            }
+        }
     }
 }
 
+
+// Same as draw_textured_spans, but every texel is drawn with draw_texel_bilinear.
+// Each filter has its own copy of the spans so the inner loop calls its texel function directly.
+static void draw_textured_spans_bilinear(
+        Window *w,
+        sampler_t *sampler,
+        int x0, int y0, int x1, int y1, int x2, int y2,
+        vec4_t point_a, vec4_t point_b, vec4_t point_c,
+        tex2_t a_uv, tex2_t b_uv, tex2_t c_uv
+    )
+{
+    ///////////////////////////////////////////////////////
+    // Render the upper part of the triangle (flat-bottom)
+    ///////////////////////////////////////////////////////
+
+    float inv_slope_1 = (float)(x1 - x0) / (y1 - y0);
+    float inv_slope_2 = (float)(x2 - x0) / (y2 - y0);
+
+    // Only draw the top (flat-bottom) half if it has vertical height.
+    // If y1 == y0, the triangle is actually flat-top and there is no top half to render.
+    if (y0 != y1)
+    {
+        // Render the flat-bottom triangle
+        for (int y = y0; y <= y1; y++)
+        {   
+            float x_start = x1 + (y - y1) * inv_slope_1;
+            float x_end = x0 + (y - y0) * inv_slope_2;
+
+            // Swap if x_start is to the right of x_end
+            if (x_end < x_start) float_swap(&x_start, &x_end);
+
+            for (int x = x_start; x <= x_end; x++)
+            {
+                // Draw the pixel that comes from the texture
+                draw_texel_bilinear(w, x, y, sampler, point_a, point_b, point_c, a_uv, b_uv, c_uv);
+            }
+        }
+    }
+
+    ///////////////////////////////////////////////////////
+    // Render the bottom part of the triangle (flat-top)
+    ///////////////////////////////////////////////////////
+
+    inv_slope_1 = (float)(x2 - x1) / (y2 - y1);
+    inv_slope_2 = (float)(x2 - x0) / (y2 - y0);
+
+    // Only draw the bottom (flat-yop) half if it has vertical height.
+    // If y1 == y2, the triangle is actually flat-bottom and there is no bottom half to render.
+    if (y1  != y2)
+    {
+        // Render the flat-top triangle
+        for (int y = y1; y <= y2; y++)
+        {
+            // Find the new x_start and x_end for the scanline
+            float x_start = x1 + (y - y1) * inv_slope_1;
+            float x_end = x0 + (y - y0) * inv_slope_2;
+
+            // Swap if x_start is to the right of x_end
+            // This can occur if the object is rotated
+            if (x_end < x_start) float_swap(&x_start, &x_end);
+
+            for (int x = x_start; x <= x_end; x++)
+            {
+                // Draw the pixel that comes from the texture
+                draw_texel_bilinear(w, x, y, sampler, point_a, point_b, point_c, a_uv, b_uv, c_uv);
+            }
+        }
+    }
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////////
 // Draw a textured triangle based on a texture array of colors.
 // We split the original triangle in two, half flat-bottom and half flat-top.
@@ -276,7 +435,7 @@ void draw_texel(
 /////////////////////////////////////////////////////////////////////////////
 void draw_textured_triangle(
         Window *w,
-        upng_t *texture,
+        sampler_t *sampler,
         int x0, int y0, float z0, float w0, float u0, float v0,
         int x1, int y1, float z1, float w1, float u1, float v1,
         int x2, int y2, float z2, float w2, float u2, float v2
@@ -320,63 +479,11 @@ void draw_textured_triangle(
     tex2_t b_uv = {u1, v1};
     tex2_t c_uv = {u2, v2};
 
-    ///////////////////////////////////////////////////////
-    // Render the upper part of the triangle (flat-bottom)
-    ///////////////////////////////////////////////////////
-
-    float inv_slope_1 = (float)(x1 - x0) / (y1 - y0);
-    float inv_slope_2 = (float)(x2 - x0) / (y2 - y0);
-
-    // Only draw the top (flat-bottom) half if it has vertical height.
-    // If y1 == y0, the triangle is actually flat-top and there is no top half to render.
-    if (y0 != y1)
-    {
-        // Render the flat-bottom triangle
-        for (int y = y0; y <= y1; y++)
-        {   
-            float x_start = x1 + (y - y1) * inv_slope_1;
-            float x_end = x0 + (y - y0) * inv_slope_2;
-
-            // Swap if x_start is to the right of x_end
-            if (x_end < x_start) float_swap(&x_start, &x_end);
-
-            for (int x = x_start; x <= x_end; x++)
-            {
-                // Draw the pixel that comes from the texture
-                draw_texel(w, x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv);
-            }
-        }
-    }
-
-    ///////////////////////////////////////////////////////
-    // Render the bottom part of the triangle (flat-top)
-    ///////////////////////////////////////////////////////
-
-    inv_slope_1 = (float)(x2 - x1) / (y2 - y1);
-    inv_slope_2 = (float)(x2 - x0) / (y2 - y0);
-
-    // Only draw the bottom (flat-yop) half if it has vertical height.
-    // If y1 == y2, the triangle is actually flat-bottom and there is no bottom half to render.
-    if (y1  != y2)
-    {
-        // Render the flat-top triangle
-        for (int y = y1; y <= y2; y++)
-        {
-            // Find the new x_start and x_end for the scanline
-            float x_start = x1 + (y - y1) * inv_slope_1;
-            float x_end = x0 + (y - y0) * inv_slope_2;
-
-            // Swap if x_start is to the right of x_end
-            // This can occur if the object is rotated
-            if (x_end < x_start) float_swap(&x_start, &x_end);
-
-            for (int x = x_start; x <= x_end; x++)
-            {
-                // Draw the pixel that comes from the texture
-                draw_texel(w, x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv);
-            }
-        }
-    }
+    // The filter is the same for the whole triangle, so pick the spans for it once
+    if (sampler->filter == TEXTURE_BILINEAR)
+        draw_textured_spans_bilinear(w, sampler, x0, y0, x1, y1, x2, y2, point_a, point_b, point_c, a_uv, b_uv, c_uv);
+    else
+        draw_textured_spans(w, sampler, x0, y0, x1, y1, x2, y2, point_a, point_b, point_c, a_uv, b_uv, c_uv);
 }
 
 
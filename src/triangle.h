@@ -24,7 +24,8 @@ typedef struct
     vec4_t points[3];
     tex2_t texcoords[3];
     uint32_t color;
-    upng_t *texture;
+    texture_t *texture;
+    enum Texture_Wrap texture_wrap;  // how the mesh samples UVs outside 0-1
 } triangle_t;
 
 vec3_t get_triangle_normal(vec4_t vertices[3]);
@@ -49,14 +50,21 @@ vec3_t barycentric_weights(vec2_t a, vec2_t b, vec2_t c, vec2_t p);
 
 void draw_texel(
     Window *w,
-    int x, int y, upng_t *texture,
+    int x, int y, sampler_t *sampler,
+    vec4_t point_a, vec4_t point_b, vec4_t point_c,
+    tex2_t a_uv, tex2_t b_uv, tex2_t c_uv
+);
+
+void draw_texel_bilinear(
+    Window *w,
+    int x, int y, sampler_t *sampler,
     vec4_t point_a, vec4_t point_b, vec4_t point_c,
     tex2_t a_uv, tex2_t b_uv, tex2_t c_uv
 );
 
 void draw_textured_triangle(
     Window *w,
-    upng_t *texture,
+    sampler_t *sampler,
     int x0, int y0, float z0, float w0, float u0, float v0,
     int x1, int y1, float z1, float w1, float u1, float v1,
     int x2, int y2, float z2, float w2, float u2, float v2
@@ -28,9 +28,30 @@ freely, subject to the following restrictions:
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
 
 #include "upng.h"
 
+/* files are mapped into memory rather than read into a copy, so the only large allocation during a decode is the image itself */
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* unfilter 3 and 4 byte pixels with SSE2, define UPNG_CHECK_SIMD to check every such scanline against the scalar filters */
+#if defined(__SSE2__) && !defined(UPNG_NO_SIMD)
+#define UPNG_SIMD_UNFILTER
+#include <emmintrin.h>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#endif
+
 #define MAKE_BYTE(b) ((b) & 0xFF)
 #define MAKE_DWORD(a,b,c,d) ((MAKE_BYTE(a) << 24) | (MAKE_BYTE(b) << 16) | (MAKE_BYTE(c) << 8) | MAKE_BYTE(d))
 #define MAKE_DWORD_PTR(p) MAKE_DWORD((p)[0], (p)[1], (p)[2], (p)[3])
@@ -52,6 +73,13 @@ freely, subject to the following restrictions:
 #define CODE_LENGTH_BITLEN 7
 #define MAX_BIT_LENGTH 15 /* largest bitlen used by any tree type */
 
+#define HUFFMAN_TABLE_BITS 10	/* codes up to this long decode with a single table lookup */
+#define HUFFMAN_TABLE_SIZE (1 << HUFFMAN_TABLE_BITS)
+#define HUFFMAN_ENTRY_VALUE_MASK 0xFFFF	/* the symbol, or the tree node a longer code continues from */
+#define HUFFMAN_ENTRY_LENGTH_SHIFT 16	/* bits consumed by the lookup */
+#define HUFFMAN_ENTRY_LENGTH_MASK 0xF
+#define HUFFMAN_ENTRY_SYMBOL 0x100000	/* set when the value is a symbol, not a tree node */
+
 #define DEFLATE_CODE_BUFFER_SIZE (NUM_DEFLATE_CODE_SYMBOLS * 2)
 #define DISTANCE_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
 #define CODE_LENGTH_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
@@ -80,6 +108,7 @@ typedef struct upng_source {
 	const unsigned char*	buffer;
 	unsigned long			size;
 	char					owning;
+	char					mapped;		/*buffer is a read only view of the file, unmap instead of free */
 } upng_source;
 
 struct upng_t {
@@ -102,6 +131,7 @@ struct upng_t {
 
 typedef struct huffman_tree {
 	unsigned* tree2d;
+	unsigned* table;	/*HUFFMAN_TABLE_SIZE entries, indexed by the next HUFFMAN_TABLE_BITS bits of the stream */
 	unsigned maxbitlen;	/*maximum number of bits a single code can get */
 	unsigned numcodes;	/*number of symbols in the alphabet = number of codes */
 } huffman_tree;
@@ -176,30 +206,174 @@ static const unsigned FIXED_DISTANCE_TREE[NUM_DISTANCE_SYMBOLS * 2] = {
 	29, 30, 31, 0, 0
 };
 
-static unsigned char read_bit(unsigned long *bitpointer, const unsigned char *bitstream)
+/*the bit reader keeps up to 64 bits of the stream in a register, lsb first, and refills it a byte at a time instead of indexing memory for every bit.
+  the zlib stream is split over the IDAT chunks of the png, the reader walks from one chunk's data to the next so it never has to be copied out*/
+typedef struct bit_reader {
+	const unsigned char*	in;			/*data of the current IDAT chunk */
+	unsigned long			in_size;
+	unsigned long			in_pos;
+	const unsigned char*	chunk;		/*next chunk to look for IDAT data in */
+	const unsigned char*	end;		/*end of the chunks */
+	unsigned long			size;		/*bytes in the whole stream */
+	unsigned long			pos;		/*bytes of the stream shifted into the buffer, may run past size (those bytes read as 0) */
+	uint64_t				buffer;		/*bits not consumed yet, the next bit is bit 0 */
+	unsigned				count;		/*number of valid bits in the buffer */
+} bit_reader;
+
+/*chunk and end bound the already validated chunks after IHDR, size is the total length of the IDAT data*/
+static void bit_reader_init(bit_reader* br, const unsigned char* chunk, const unsigned char* end, unsigned long size)
 {
-	unsigned char result = (unsigned char)((bitstream[(*bitpointer) >> 3] >> ((*bitpointer) & 0x7)) & 1);
-	(*bitpointer)++;
-	return result;
+	br->in = NULL;
+	br->in_size = 0;
+	br->in_pos = 0;
+	br->chunk = chunk;
+	br->end = end;
+	br->size = size;
+	br->pos = 0;
+	br->buffer = 0;
+	br->count = 0;
 }
 
-static unsigned read_bits(unsigned long *bitpointer, const unsigned char *bitstream, unsigned long nbits)
+/*move on to the data of the next non empty IDAT chunk, return 0 at IEND or the end of the file*/
+static int bit_reader_next_chunk(bit_reader* br)
 {
-	unsigned result = 0, i;
-	for (i = 0; i < nbits; i++)
-		result |= ((unsigned)read_bit(bitpointer, bitstream)) << i;
+	while (br->chunk < br->end) {
+		const unsigned char *chunk = br->chunk;
+		unsigned long length = upng_chunk_length(chunk);
+
+		if (upng_chunk_type(chunk) == CHUNK_IEND) {
+			break;
+		}
+
+		br->chunk += length + 12;
+		if (upng_chunk_type(chunk) == CHUNK_IDAT && length > 0) {
+			br->in = chunk + 8;
+			br->in_size = length;
+			br->in_pos = 0;
+			return 1;
+		}
+	}
+
+	br->chunk = br->end;
+	return 0;
+}
+
+/*top the buffer up to at least 57 bits. past the end of the input we shift in zeros, bit_reader_overrun() catches anyone that actually consumes them*/
+static void bit_reader_refill(bit_reader* br)
+{
+	while (br->count <= 56) {
+		uint64_t byte = 0;
+		if (br->in_pos < br->in_size || bit_reader_next_chunk(br)) {
+			byte = br->in[br->in_pos++];
+		}
+		br->buffer |= byte << br->count;
+		br->pos++;
+		br->count += 8;
+	}
+}
+
+/*copy whole bytes out of the stream, the reader must be at a byte boundary. return the number of bytes copied*/
+static unsigned long bit_reader_copy(bit_reader* br, unsigned char* out, unsigned long length)
+{
+	unsigned long copied = 0;
+
+	/* bytes already in the bit buffer come first */
+	while (copied < length && br->count >= 8) {
+		out[copied++] = (unsigned char)(br->buffer & 0xFF);
+		br->buffer >>= 8;
+		br->count -= 8;
+	}
+
+	while (copied < length) {
+		unsigned long n;
+
+		if (br->in_pos >= br->in_size && !bit_reader_next_chunk(br)) {
+			break;
+		}
+
+		n = br->in_size - br->in_pos;
+		if (n > length - copied) {
+			n = length - copied;
+		}
+		memcpy(out + copied, br->in + br->in_pos, n);
+		br->in_pos += n;
+		br->pos += n;
+		copied += n;
+	}
+
+	return copied;
+}
+
+/*true once more bits have been consumed than the input holds*/
+static int bit_reader_overrun(const bit_reader* br)
+{
+	return br->pos * 8 - br->count > br->size * 8;
+}
+
+/*byte holding the next unconsumed bit*/
+static unsigned long bit_reader_byte_pos(const bit_reader* br)
+{
+	return (br->pos * 8 - br->count) >> 3;
+}
+
+static unsigned read_bits(bit_reader* br, unsigned nbits)
+{
+	unsigned result;
+	if (br->count < nbits) {
+		bit_reader_refill(br);
+	}
+	result = (unsigned)(br->buffer & ((1u << nbits) - 1));
+	br->buffer >>= nbits;
+	br->count -= nbits;
 	return result;
 }
 
+static unsigned read_bit(bit_reader* br)
+{
+	return read_bits(br, 1);
+}
+
 /* the buffer must be numcodes*2 in size! */
-static void huffman_tree_init(huffman_tree* tree, unsigned* buffer, unsigned numcodes, unsigned maxbitlen)
+static void huffman_tree_init(huffman_tree* tree, unsigned* buffer, unsigned* table, unsigned numcodes, unsigned maxbitlen)
 {
 	tree->tree2d = buffer;
+	tree->table = table;
 
 	tree->numcodes = numcodes;
 	tree->maxbitlen = maxbitlen;
 }
 
+/*fill the fast table below tree node treepos, which is reached after depth bits that spell out prefix (first bit in bit 0)*/
+static void huffman_table_fill(huffman_tree* tree, unsigned treepos, unsigned depth, unsigned prefix)
+{
+	unsigned bit;
+	for (bit = 0; bit < 2; bit++) {
+		unsigned ct = tree->tree2d[(treepos << 1) | bit];
+		unsigned index = prefix | (bit << depth);
+		unsigned length = depth + 1;
+
+		if (ct < tree->numcodes) {
+			/*a code shorter than the table repeats for every value of the bits after it*/
+			unsigned entry = HUFFMAN_ENTRY_SYMBOL | (length << HUFFMAN_ENTRY_LENGTH_SHIFT) | ct;
+			for (; index < HUFFMAN_TABLE_SIZE; index += 1u << length) {
+				tree->table[index] = entry;
+			}
+		} else if (length < HUFFMAN_TABLE_BITS) {
+			huffman_table_fill(tree, ct - tree->numcodes, length, index);
+		} else {
+			/*too long for the table, the decoder continues walking the tree from this node*/
+			tree->table[index] = (length << HUFFMAN_ENTRY_LENGTH_SHIFT) | (ct - tree->numcodes);
+		}
+	}
+}
+
+/*build the lookup table that decodes up to HUFFMAN_TABLE_BITS bits at once from tree2d*/
+static void huffman_table_create(huffman_tree* tree)
+{
+	memset(tree->table, 0, HUFFMAN_TABLE_SIZE * sizeof(unsigned));
+	huffman_table_fill(tree, 0, 0, 0);
+}
+
 /*given the code lengths (as stored in the PNG file), generate the tree as defined by Deflate. maxbitlen is the maximum bits that a code in the tree can have. return value is error.*/
 static void huffman_tree_create_lengths(upng_t* upng, huffman_tree* tree, const unsigned *bitlen)
 {
@@ -266,36 +440,60 @@ static void huffman_tree_create_lengths(upng_t* upng, huffman_tree* tree, const
 			tree->tree2d[n] = 0;	/*remove possible remaining 32767's */
 		}
 	}
+
+	huffman_table_create(tree);
 }
 
-static unsigned huffman_decode_symbol(upng_t *upng, const unsigned char *in, unsigned long *bp, const huffman_tree* codetree, unsigned long inlength)
+static unsigned huffman_decode_symbol(upng_t *upng, bit_reader* br, const huffman_tree* codetree)
 {
-	unsigned treepos = 0, ct;
-	unsigned char bit;
-	for (;;) {
-		/* error: end of input memory reached without endcode */
-		if (((*bp) & 0x07) == 0 && ((*bp) >> 3) > inlength) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return 0;
-		}
+	unsigned entry, length, treepos, ct;
 
-		bit = read_bit(bp, in);
+	/*one refill is enough for the longest code*/
+	if (br->count < MAX_BIT_LENGTH) {
+		bit_reader_refill(br);
+	}
 
-		ct = codetree->tree2d[(treepos << 1) | bit];
-		if (ct < codetree->numcodes) {
-			return ct;
-		}
+	/*fast path: the next HUFFMAN_TABLE_BITS bits either hold a whole code, or lead to the tree node where a longer one continues */
+	entry = codetree->table[br->buffer & (HUFFMAN_TABLE_SIZE - 1)];
+	if (entry == 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return 0;
+	}
 
-		treepos = ct - codetree->numcodes;
-		if (treepos >= codetree->numcodes) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return 0;
+	length = (entry >> HUFFMAN_ENTRY_LENGTH_SHIFT) & HUFFMAN_ENTRY_LENGTH_MASK;
+	br->buffer >>= length;
+	br->count -= length;
+
+	if (entry & HUFFMAN_ENTRY_SYMBOL) {
+		ct = entry & HUFFMAN_ENTRY_VALUE_MASK;
+	} else {
+		/*slow path: walk the rest of a long code one bit at a time */
+		treepos = entry & HUFFMAN_ENTRY_VALUE_MASK;
+		for (;;) {
+			ct = codetree->tree2d[(treepos << 1) | read_bit(br)];
+			if (ct < codetree->numcodes) {
+				break;
+			}
+
+			treepos = ct - codetree->numcodes;
+			if (treepos >= codetree->numcodes) {
+				SET_ERROR(upng, UPNG_EMALFORMED);
+				return 0;
+			}
 		}
 	}
+
+	/* error: end of input memory reached without endcode */
+	if (bit_reader_overrun(br)) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return 0;
+	}
+
+	return ct;
 }
 
 /* get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffman_tree* codetreeD, huffman_tree* codelengthcodetree, const unsigned char *in, unsigned long *bp, unsigned long inlength)
+static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffman_tree* codetreeD, huffman_tree* codelengthcodetree, bit_reader* br)
 {
 	unsigned codelengthcode[NUM_CODE_LENGTH_CODES];
 	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
@@ -304,7 +502,7 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 
 	/*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated */
 	/*C-code note: use no "return" between ctor and dtor of an uivector! */
-	if ((*bp) >> 3 >= inlength - 2) {
+	if (bit_reader_byte_pos(br) >= br->size - 2) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
@@ -314,13 +512,13 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 	memset(bitlenD, 0, sizeof(bitlenD));
 
 	/*the bit pointer is or will go past the memory */
-	hlit = read_bits(bp, in, 5) + 257;	/*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already */
-	hdist = read_bits(bp, in, 5) + 1;	/*number of distance codes. Unlike the spec, the value 1 is added to it here already */
-	hclen = read_bits(bp, in, 4) + 4;	/*number of code length codes. Unlike the spec, the value 4 is added to it here already */
+	hlit = read_bits(br, 5) + 257;	/*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already */
+	hdist = read_bits(br, 5) + 1;	/*number of distance codes. Unlike the spec, the value 1 is added to it here already */
+	hclen = read_bits(br, 4) + 4;	/*number of code length codes. Unlike the spec, the value 4 is added to it here already */
 
 	for (i = 0; i < NUM_CODE_LENGTH_CODES; i++) {
 		if (i < hclen) {
-			codelengthcode[CLCL[i]] = read_bits(bp, in, 3);
+			codelengthcode[CLCL[i]] = read_bits(br, 3);
 		} else {
 			codelengthcode[CLCL[i]] = 0;	/*if not, it must stay 0 */
 		}
@@ -336,7 +534,7 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 	/*now we can use this tree to read the lengths for the tree that this function will return */
 	i = 0;
 	while (i < hlit + hdist) {	/*i is the current symbol we're reading in the part that contains the code lengths of lit/len codes and dist codes */
-		unsigned code = huffman_decode_symbol(upng, in, bp, codelengthcodetree, inlength);
+		unsigned code = huffman_decode_symbol(upng, br, codelengthcodetree);
 		if (upng->error != UPNG_EOK) {
 			break;
 		}
@@ -352,12 +550,12 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 			unsigned replength = 3;	/*read in the 2 bits that indicate repeat length (3-6) */
 			unsigned value;	/*set value to the previous code */
 
-			if ((*bp) >> 3 >= inlength) {
+			if (bit_reader_byte_pos(br) >= br->size) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				break;
 			}
 			/*error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 2);
+			replength += read_bits(br, 2);
 
 			if ((i - 1) < hlit) {
 				value = bitlen[i - 1];
@@ -382,13 +580,13 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 			}
 		} else if (code == 17) {	/*repeat "0" 3-10 times */
 			unsigned replength = 3;	/*read in the bits that indicate repeat length */
-			if ((*bp) >> 3 >= inlength) {
+			if (bit_reader_byte_pos(br) >= br->size) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				break;
 			}
 
 			/*error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 3);
+			replength += read_bits(br, 3);
 
 			/*repeat this value in the next lengths */
 			for (n = 0; n < replength; n++) {
@@ -408,12 +606,12 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 		} else if (code == 18) {	/*repeat "0" 11-138 times */
 			unsigned replength = 11;	/*read in the bits that indicate repeat length */
 			/* error, bit pointer jumps past memory */
-			if ((*bp) >> 3 >= inlength) {
+			if (bit_reader_byte_pos(br) >= br->size) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				break;
 			}
 
-			replength += read_bits(bp, in, 7);
+			replength += read_bits(br, 7);
 
 			/*repeat this value in the next lengths */
 			for (n = 0; n < replength; n++) {
@@ -450,10 +648,12 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 }
 
 /*inflate a block with dynamic of fixed Huffman tree*/
-static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength, unsigned btype)
+static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outsize, bit_reader* br, unsigned long *pos, unsigned btype)
 {
 	unsigned codetree_buffer[DEFLATE_CODE_BUFFER_SIZE];
 	unsigned codetreeD_buffer[DISTANCE_BUFFER_SIZE];
+	unsigned codetree_table[HUFFMAN_TABLE_SIZE];
+	unsigned codetreeD_table[HUFFMAN_TABLE_SIZE];
 	unsigned done = 0;
 
 	huffman_tree codetree;
@@ -461,21 +661,24 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 
 	if (btype == 1) {
 		/* fixed trees */
-		huffman_tree_init(&codetree, (unsigned*)FIXED_DEFLATE_CODE_TREE, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, (unsigned*)FIXED_DISTANCE_TREE, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
+		huffman_tree_init(&codetree, (unsigned*)FIXED_DEFLATE_CODE_TREE, codetree_table, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
+		huffman_tree_init(&codetreeD, (unsigned*)FIXED_DISTANCE_TREE, codetreeD_table, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
+		huffman_table_create(&codetree);
+		huffman_table_create(&codetreeD);
 	} else if (btype == 2) {
 		/* dynamic trees */
 		unsigned codelengthcodetree_buffer[CODE_LENGTH_BUFFER_SIZE];
+		unsigned codelengthcodetree_table[HUFFMAN_TABLE_SIZE];
 		huffman_tree codelengthcodetree;
 
-		huffman_tree_init(&codetree, codetree_buffer, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, codetreeD_buffer, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
-		huffman_tree_init(&codelengthcodetree, codelengthcodetree_buffer, NUM_CODE_LENGTH_CODES, CODE_LENGTH_BITLEN);
-		get_tree_inflate_dynamic(upng, &codetree, &codetreeD, &codelengthcodetree, in, bp, inlength);
+		huffman_tree_init(&codetree, codetree_buffer, codetree_table, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
+		huffman_tree_init(&codetreeD, codetreeD_buffer, codetreeD_table, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
+		huffman_tree_init(&codelengthcodetree, codelengthcodetree_buffer, codelengthcodetree_table, NUM_CODE_LENGTH_CODES, CODE_LENGTH_BITLEN);
+		get_tree_inflate_dynamic(upng, &codetree, &codetreeD, &codelengthcodetree, br);
 	}
 
 	while (done == 0) {
-		unsigned code = huffman_decode_symbol(upng, in, bp, &codetree, inlength);
+		unsigned code = huffman_decode_symbol(upng, br, &codetree);
 		if (upng->error != UPNG_EOK) {
 			return;
 		}
@@ -502,14 +705,14 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 			numextrabits = LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX];
 
 			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
+			if (bit_reader_byte_pos(br) >= br->size) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
-			length += read_bits(bp, in, numextrabits);
+			length += read_bits(br, numextrabits);
 
 			/*part 3: get distance code */
-			codeD = huffman_decode_symbol(upng, in, bp, &codetreeD, inlength);
+			codeD = huffman_decode_symbol(upng, br, &codetreeD);
 			if (upng->error != UPNG_EOK) {
 				return;
 			}
@@ -526,17 +729,23 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 			numextrabitsD = DISTANCE_EXTRA[codeD];
 
 			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
+			if (bit_reader_byte_pos(br) >= br->size) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
 
-			distance += read_bits(bp, in, numextrabitsD);
+			distance += read_bits(br, numextrabitsD);
 
 			/*part 5: fill in all the out[n] values based on the length and dist */
 			start = (*pos);
 			backward = start - distance;
 
+			/* error, distance points back before the start of the output */
+			if (distance > start) {
+				SET_ERROR(upng, UPNG_EMALFORMED);
+				return;
+			}
+
 			if ((*pos) + length >= outsize) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
@@ -554,16 +763,15 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 	}
 }
 
-static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength)
+static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long outsize, bit_reader* br, unsigned long *pos)
 {
+	unsigned long inlength = br->size;
 	unsigned long p;
-	unsigned len, nlen, n;
+	unsigned len, nlen;
 
 	/* go to first boundary of byte */
-	while (((*bp) & 0x7) != 0) {
-		(*bp)++;
-	}
-	p = (*bp) / 8;		/*byte position */
+	read_bits(br, br->count & 0x7);
+	p = bit_reader_byte_pos(br);		/*byte position */
 
 	/* read len (2 bytes) and nlen (2 bytes) */
 	if (p >= inlength - 4) {
@@ -571,10 +779,9 @@ static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long
 		return;
 	}
 
-	len = in[p] + 256 * in[p + 1];
-	p += 2;
-	nlen = in[p] + 256 * in[p + 1];
-	p += 2;
+	len = read_bits(br, 16);
+	nlen = read_bits(br, 16);
+	p += 4;
 
 	/* check if 16-bit nlen is really the one's complement of len */
 	if (len + nlen != 65535) {
@@ -593,17 +800,16 @@ static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long
 		return;
 	}
 
-	for (n = 0; n < len; n++) {
-		out[(*pos)++] = in[p++];
+	if (bit_reader_copy(br, &out[*pos], len) != len) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
 	}
-
-	(*bp) = p * 8;
+	(*pos) += len;
 }
 
 /*inflate the deflated data (cfr. deflate spec); return value is the error*/
-static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long insize, unsigned long inpos)
+static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned long outsize, bit_reader* br)
 {
-	unsigned long bp = 0;	/*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte) */
 	unsigned long pos = 0;	/*byte position in the out buffer */
 
 	unsigned done = 0;
@@ -612,23 +818,23 @@ static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned lon
 		unsigned btype;
 
 		/* ensure next bit doesn't point past the end of the buffer */
-		if ((bp >> 3) >= insize) {
+		if (bit_reader_byte_pos(br) >= br->size) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		}
 
 		/* read block control bits */
-		done = read_bit(&bp, &in[inpos]);
-		btype = read_bit(&bp, &in[inpos]) | (read_bit(&bp, &in[inpos]) << 1);
+		done = read_bit(br);
+		btype = read_bits(br, 2);
 
 		/* process control type appropriateyly */
 		if (btype == 3) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		} else if (btype == 0) {
-			inflate_uncompressed(upng, out, outsize, &in[inpos], &bp, &pos, insize);	/*no compression */
+			inflate_uncompressed(upng, out, outsize, br, &pos);	/*no compression */
 		} else {
-			inflate_huffman(upng, out, outsize, &in[inpos], &bp, &pos, insize, btype);	/*compression, btype 01 or 10 */
+			inflate_huffman(upng, out, outsize, br, &pos, btype);	/*compression, btype 01 or 10 */
 		}
 
 		/* stop if an error has occured */
@@ -640,13 +846,17 @@ static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned lon
 	return upng->error;
 }
 
-static upng_error uz_inflate(upng_t* upng, unsigned char *out, unsigned long outsize, const unsigned char *in, unsigned long insize)
+static upng_error uz_inflate(upng_t* upng, unsigned char *out, unsigned long outsize, bit_reader* br)
 {
+	unsigned char in[2];
+
 	/* we require two bytes for the zlib data header */
-	if (insize < 2) {
+	if (br->size < 2) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
+	in[0] = (unsigned char)read_bits(br, 8);
+	in[1] = (unsigned char)read_bits(br, 8);
 
 	/* 256 * in[0] + in[1] must be a multiple of 31, the FCHECK value is supposed to be made that way */
 	if ((in[0] * 256 + in[1]) % 31 != 0) {
@@ -667,7 +877,7 @@ static upng_error uz_inflate(upng_t* upng, unsigned char *out, unsigned long out
 	}
 
 	/* create output buffer */
-	uz_inflate_data(upng, out, outsize, in, insize, 2);
+	uz_inflate_data(upng, out, outsize, br);
 
 	return upng->error;
 }
@@ -688,7 +898,109 @@ static int paeth_predictor(int a, int b, int c)
 		return c;
 }
 
-static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
+#ifdef UPNG_SIMD_UNFILTER
+/*load or store one 3 or 4 byte pixel in the low lane of a register, going through memcpy so 3 byte pixels never touch the byte after them*/
+static __m128i load_pixel(const unsigned char *p, unsigned long bytewidth)
+{
+	uint32_t v = 0;
+	memcpy(&v, p, bytewidth);
+	return _mm_cvtsi32_si128((int)v);
+}
+
+static void store_pixel(unsigned char *p, __m128i v, unsigned long bytewidth)
+{
+	uint32_t x = (uint32_t)_mm_cvtsi128_si32(v);
+	memcpy(p, &x, bytewidth);
+}
+
+static __m128i abs_epi16(__m128i x)
+{
+#ifdef __SSSE3__
+	return _mm_abs_epi16(x);
+#else
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+#endif
+}
+
+static __m128i if_then_else(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/*
+   SSE2 (and SSSE3 when available) versions of filters 1-4 for 3 and 4 byte pixels, below the first scanline.
+   Up has no dependency between bytes, so it runs 16 bytes at a time. Sub, Average and Paeth depend on the pixel to the left,
+   so they run a pixel at a time, with all of a pixel's channels in one register.
+   Like unfilter_scanline, recon may be the same memory as scanline (or just before it): every pixel is loaded before its result is stored.
+ */
+static void unfilter_scanline_simd(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
+{
+	const __m128i zero = _mm_setzero_si128();
+	unsigned long i = 0;
+
+	switch (filterType) {
+	case 1: {
+		__m128i a = zero;
+		for (i = 0; i < length; i += bytewidth) {
+			a = _mm_add_epi8(a, load_pixel(&scanline[i], bytewidth));
+			store_pixel(&recon[i], a, bytewidth);
+		}
+		break;
+	}
+	case 2:
+		for (i = 0; i + 16 <= length; i += 16) {
+			__m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+			__m128i b = _mm_loadu_si128((const __m128i*)&precon[i]);
+			_mm_storeu_si128((__m128i*)&recon[i], _mm_add_epi8(x, b));
+		}
+		for (; i < length; i++)
+			recon[i] = scanline[i] + precon[i];
+		break;
+	case 3: {
+		__m128i a = zero;
+		for (i = 0; i < length; i += bytewidth) {
+			__m128i b = load_pixel(&precon[i], bytewidth);
+			/*_mm_avg_epu8 rounds up, the filter rounds down */
+			__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+			a = _mm_add_epi8(average, load_pixel(&scanline[i], bytewidth));
+			store_pixel(&recon[i], a, bytewidth);
+		}
+		break;
+	}
+	case 4: {
+		/*a is the pixel to the left, b the one above and c the one above and to the left, widened to 16 bits */
+		__m128i a = zero, c = zero;
+		for (i = 0; i < length; i += bytewidth) {
+			__m128i b = _mm_unpacklo_epi8(load_pixel(&precon[i], bytewidth), zero);
+			__m128i pa, pb, pc, smallest, nearest;
+
+			/*p = a + b - c, so |p - a| = |b - c|, |p - b| = |a - c| and |p - c| = |(b - c) + (a - c)| */
+			pa = _mm_sub_epi16(b, c);
+			pb = _mm_sub_epi16(a, c);
+			pc = _mm_add_epi16(pa, pb);
+
+			pa = abs_epi16(pa);
+			pb = abs_epi16(pb);
+			pc = abs_epi16(pc);
+
+			/*ties go to a, then b, the same as paeth_predictor */
+			smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+			nearest = if_then_else(_mm_cmpeq_epi16(smallest, pa), a,
+				if_then_else(_mm_cmpeq_epi16(smallest, pb), b, c));
+
+			nearest = _mm_add_epi8(_mm_packus_epi16(nearest, zero), load_pixel(&scanline[i], bytewidth));
+			store_pixel(&recon[i], nearest, bytewidth);
+
+			a = _mm_unpacklo_epi8(nearest, zero);
+			c = b;
+		}
+		break;
+	}
+	}
+}
+#endif
+
+static void unfilter_scanline_scalar(upng_t* upng, unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
 {
 	/*
 	   For PNG filter method 0
@@ -750,6 +1062,36 @@ static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned
 	}
 }
 
+static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
+{
+#ifdef UPNG_SIMD_UNFILTER
+	/* the first scanline has nothing above it and is left to the scalar filters */
+	if (precon && (bytewidth == 3 || bytewidth == 4) && filterType >= 1 && filterType <= 4) {
+#ifdef UPNG_CHECK_SIMD
+		/* scanline may be overwritten by recon, so the scalar version works from a copy */
+		unsigned char *expected = (unsigned char*)malloc(length * 2);
+		if (expected != NULL) {
+			memcpy(expected + length, scanline, length);
+			unfilter_scanline_scalar(upng, expected, expected + length, precon, bytewidth, filterType, length);
+		}
+#endif
+		unfilter_scanline_simd(recon, scanline, precon, bytewidth, filterType, length);
+#ifdef UPNG_CHECK_SIMD
+		if (expected != NULL) {
+			if (memcmp(expected, recon, length) != 0) {
+				fprintf(stderr, "upng: SIMD unfilter (type %u, %lu bytes per pixel) does not match the scalar version\n", filterType, bytewidth);
+				SET_ERROR(upng, UPNG_EMALFORMED);
+			}
+			free(expected);
+		}
+#endif
+		return;
+	}
+#endif
+
+	unfilter_scanline_scalar(upng, recon, scanline, precon, bytewidth, filterType, length);
+}
+
 static void unfilter(upng_t* upng, unsigned char *out, const unsigned char *in, unsigned w, unsigned h, unsigned bpp)
 {
 	/*
@@ -883,13 +1225,20 @@ static upng_format determine_format(upng_t* upng) {
 
 static void upng_free_source(upng_t* upng)
 {
-	if (upng->source.owning != 0) {
+	if (upng->source.mapped != 0) {
+#ifdef _WIN32
+		UnmapViewOfFile((LPCVOID)upng->source.buffer);
+#else
+		munmap((void*)upng->source.buffer, upng->source.size);
+#endif
+	} else if (upng->source.owning != 0) {
 		free((void*)upng->source.buffer);
 	}
 
 	upng->source.buffer = NULL;
 	upng->source.size = 0;
 	upng->source.owning = 0;
+	upng->source.mapped = 0;
 }
 
 /*read the information from the header and store it in the upng_Info. return value is error*/
@@ -964,10 +1313,10 @@ upng_error upng_header(upng_t* upng)
 upng_error upng_decode(upng_t* upng)
 {
 	const unsigned char *chunk;
-	unsigned char* compressed;
 	unsigned char* inflated;
-	unsigned long compressed_size = 0, compressed_index = 0;
+	unsigned long compressed_size = 0;
 	unsigned long inflated_size;
+	bit_reader br;
 	upng_error error;
 
 	/* if we have an error state, bail now */
@@ -1037,73 +1386,31 @@ upng_error upng_decode(upng_t* upng)
 		chunk += upng_chunk_length(chunk) + 12;
 	}
 
-	/* allocate enough space for the (compressed and filtered) image data */
-	compressed = (unsigned char*)malloc(compressed_size);
-	if (compressed == NULL) {
-		SET_ERROR(upng, UPNG_ENOMEM);
-		return upng->error;
-	}
-
-	/* scan through the chunks again, this time copying the values into
-	 * our compressed buffer.  there's no reason to validate anything a second time. */
-	chunk = upng->source.buffer + 33;
-	while (chunk < upng->source.buffer + upng->source.size) {
-		unsigned long length;
-		const unsigned char *data;	/*the data in the chunk */
-
-		length = upng_chunk_length(chunk);
-		data = chunk + 8;
-
-		/* parse chunks */
-		if (upng_chunk_type(chunk) == CHUNK_IDAT) {
-			memcpy(compressed + compressed_index, data, length);
-			compressed_index += length;
-		} else if (upng_chunk_type(chunk) == CHUNK_IEND) {
-			break;
-		}
-
-		chunk += upng_chunk_length(chunk) + 12;
-	}
-
 	/* allocate space to store inflated (but still filtered) data */
 	inflated_size = ((upng->width * (upng->height * upng_get_bpp(upng) + 7)) / 8) + upng->height;
 	inflated = (unsigned char*)malloc(inflated_size);
 	if (inflated == NULL) {
-		free(compressed);
 		SET_ERROR(upng, UPNG_ENOMEM);
 		return upng->error;
 	}
 
-	/* decompress image data */
-	error = uz_inflate(upng, inflated, inflated_size, compressed, compressed_size);
+	/* decompress image data straight out of the IDAT chunks of the source, there's no reason to validate them a second time */
+	bit_reader_init(&br, upng->source.buffer + 33, chunk, compressed_size);
+	error = uz_inflate(upng, inflated, inflated_size, &br);
 	if (error != UPNG_EOK) {
-		free(compressed);
 		free(inflated);
 		return upng->error;
 	}
 
-	/* free the compressed compressed data */
-	free(compressed);
-
-	/* allocate final image buffer */
-	upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
-	upng->buffer = (unsigned char*)malloc(upng->size);
-	if (upng->buffer == NULL) {
-		free(inflated);
-		upng->size = 0;
-		SET_ERROR(upng, UPNG_ENOMEM);
-		return upng->error;
-	}
-
-	/* unfilter scanlines */
-	post_process_scanlines(upng, upng->buffer, inflated, upng);
-	free(inflated);
+	/* unfilter scanlines in place; the image is never larger than the filtered data (it only loses the filter
+	 * byte of each scanline), so that buffer becomes our final buffer rather than allocating a second one */
+	post_process_scanlines(upng, inflated, inflated, upng);
 
 	if (upng->error != UPNG_EOK) {
-		free(upng->buffer);
-		upng->buffer = NULL;
-		upng->size = 0;
+		free(inflated);
 	} else {
+		upng->buffer = inflated;
+		upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
 		upng->state = UPNG_DECODED;
 	}
 
@@ -1139,6 +1446,7 @@ static upng_t* upng_new(void)
 	upng->source.buffer = NULL;
 	upng->source.size = 0;
 	upng->source.owning = 0;
+	upng->source.mapped = 0;
 
 	return upng;
 }
@@ -1157,10 +1465,61 @@ upng_t* upng_new_from_bytes(const unsigned char* buffer, unsigned long size)
 	return upng;
 }
 
+/*map the whole file read only, return NULL if the platform can't (an empty file, a pipe, ...)*/
+static const unsigned char* upng_map_file(const char *filename, unsigned long *size)
+{
+#ifdef _WIN32
+	HANDLE file, mapping;
+	LARGE_INTEGER file_size;
+	void *view = NULL;
+
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return NULL;
+	}
+
+	if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0 && file_size.QuadPart <= LONG_MAX) {
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL) {
+			/* the view keeps the mapping alive after its handles are closed */
+			view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+
+	*size = view != NULL ? (unsigned long)file_size.QuadPart : 0;
+	return (const unsigned char*)view;
+#else
+	struct stat st;
+	void *view = MAP_FAILED;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && (unsigned long long)st.st_size <= LONG_MAX) {
+		view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+
+	if (view == MAP_FAILED) {
+		return NULL;
+	}
+
+	*size = (unsigned long)st.st_size;
+	return (const unsigned char*)view;
+#endif
+}
+
 upng_t* upng_new_from_file(const char *filename)
 {
 	upng_t* upng;
 	unsigned char *buffer;
+	const unsigned char *view;
+	unsigned long view_size;
 	FILE *file;
 	long size;
 
@@ -1169,6 +1528,16 @@ upng_t* upng_new_from_file(const char *filename)
 		return NULL;
 	}
 
+	/* decode straight out of the page cache when we can, the file is never copied */
+	view = upng_map_file(filename, &view_size);
+	if (view != NULL) {
+		upng->source.buffer = view;
+		upng->source.size = view_size;
+		upng->source.mapped = 1;
+		return upng;
+	}
+
+	/* otherwise fall back to reading it into memory */
 	file = fopen(filename, "rb");
 	if (file == NULL) {
 		SET_ERROR(upng, UPNG_ENOTFOUND);